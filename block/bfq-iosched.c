@@ -91,6 +91,13 @@ static const int bfq_async_charge_factor = 10;
 static const int bfq_timeout_sync = HZ / 8;
 static int bfq_timeout_async = HZ / 25;
 
+/*
+ * Latency-target mode, by default used on devices flagged as
+ * non-rotational; target completion latency in usecs.
+ */
+#define BFQ_NONROT_AUTO		2
+static const int bfq_latency_target = 10000;
+
 struct kmem_cache *bfq_pool;
 struct kmem_cache *bfq_ioc_pool;
 
@@ -122,6 +129,8 @@ static DEFINE_IDA(cic_index_ida);
 #define RQ_CIC(rq)		\
 	((struct cfq_io_context *) (rq)->elevator_private)
 #define RQ_BFQQ(rq)		((rq)->elevator_private2)
+/* Dispatch time of a request in usecs, for the latency-target mode. */
+#define RQ_DISP_US(rq)		((unsigned long) (rq)->elevator_private3)
 
 #include "bfq-ioc.c"
 #include "bfq-sched.c"
@@ -435,12 +444,18 @@ static struct request *bfq_find_rq_fmerge(struct bfq_data *bfqd,
 	return NULL;
 }
 
+static inline unsigned long bfq_now_us(void)
+{
+	return (unsigned long)ktime_to_us(ktime_get());
+}
+
 static void bfq_activate_request(struct request_queue *q, struct request *rq)
 {
 	struct bfq_data *bfqd = q->elevator->elevator_data;
 
 	bfqd->rq_in_driver++;
 	bfqd->last_position = blk_rq_pos(rq) + blk_rq_sectors(rq);
+	rq->elevator_private3 = (void *)bfq_now_us();
 }
 
 static void bfq_deactivate_request(struct request_queue *q, struct request *rq)
@@ -581,6 +596,27 @@ static inline bfq_service_t bfq_min_budget(struct bfq_data *bfqd)
 		bfqd->bfq_max_budget / 32;
 }
 
+static inline int bfq_nonrot_mode(struct bfq_data *bfqd)
+{
+	if (bfqd->bfq_nonrot_mode == BFQ_NONROT_AUTO)
+		return blk_queue_nonrot(bfqd->queue);
+	return bfqd->bfq_nonrot_mode;
+}
+
+/*
+ * Async dispatching is throttled, in latency-target mode, while a
+ * weight-raised queue is missing its completion latency target.
+ */
+static int bfq_async_throttled(struct bfq_data *bfqd)
+{
+	if (bfqd->async_throttle_end == 0)
+		return 0;
+	if (time_before(jiffies, bfqd->async_throttle_end))
+		return 1;
+	bfqd->async_throttle_end = 0;
+	return 0;
+}
+
 static void bfq_arm_slice_timer(struct bfq_data *bfqd)
 {
 	struct bfq_queue *bfqq = bfqd->active_queue;
@@ -593,6 +629,15 @@ static void bfq_arm_slice_timer(struct bfq_data *bfqd)
 	if (bfqd->bfq_slice_idle == 0 || !bfq_bfqq_idle_window(bfqq))
 		return;
 
+	/*
+	 * Seeks cost nothing on a non-rotational device, so waiting for
+	 * a seeky queue buys no throughput, it just leaves the device
+	 * idle.
+	 */
+	if (bfq_nonrot_mode(bfqd) && bfq_sample_valid(bfqq->seek_samples) &&
+	    BFQQ_SEEKY(bfqq))
+		return;
+
 	/* Tasks have exited, don't wait. */
 	cic = bfqd->active_cic;
 	if (cic == NULL || atomic_read(&cic->ioc->nr_tasks) == 0)
@@ -918,6 +963,14 @@ static int bfq_update_peak_rate(struct bfq_data *bfqd, struct bfq_queue *bfqq,
 		}
 	}
 
+	/*
+	 * Seeky processes are not slow on a non-rotational device, and
+	 * charging them full budgets would only penalize random readers
+	 * such as applications being started.
+	 */
+	if (bfq_nonrot_mode(bfqd) && BFQQ_SEEKY(bfqq))
+		return 0;
+
 	/*
 	 * If the process has been served for a too short time
 	 * interval to let its possible sequential accesses prevail on
@@ -1300,9 +1353,27 @@ static int bfq_dispatch_requests(struct request_queue *q, int force)
 		if (bfq_class_idle(bfqq))
 			max_dispatch = 1;
 
-		if (!bfq_bfqq_sync(bfqq))
+		if (!bfq_bfqq_sync(bfqq)) {
 			max_dispatch = bfqd->bfq_max_budget_async_rq;
 
+			/*
+			 * Writes already queued in a flash device are what
+			 * delays its reads: while throttled, let async
+			 * requests through one at a time, and only to an
+			 * otherwise idle device. Expire the queue rather than
+			 * leaving it in service, so that the next dispatch
+			 * round can pick a sync queue.
+			 */
+			if (bfq_async_throttled(bfqd)) {
+				if (bfqd->rq_in_driver > 0) {
+					bfq_bfqq_expire(bfqd, bfqq, 0,
+						BFQ_BFQQ_NO_MORE_REQUESTS);
+					break;
+				}
+				max_dispatch = 1;
+			}
+		}
+
 		if (bfqq->dispatched >= max_dispatch) {
 			if (bfqd->busy_queues > 1)
 				break;
@@ -1635,7 +1706,8 @@ static void bfq_update_idle_window(struct bfq_data *bfqd,
 	if (atomic_read(&cic->ioc->nr_tasks) == 0 ||
 	    bfqd->bfq_slice_idle == 0 ||
 		(bfqd->hw_tag && BFQQ_SEEKY(bfqq) &&
-			bfqq->raising_coeff == 1))
+			bfqq->raising_coeff == 1) ||
+		(bfq_nonrot_mode(bfqd) && BFQQ_SEEKY(bfqq)))
 		enable_idle = 0;
 	else if (bfq_sample_valid(cic->ttime_samples)) {
 		if (cic->ttime_mean > bfqd->bfq_slice_idle)
@@ -1755,6 +1827,33 @@ static void bfq_update_hw_tag(struct bfq_data *bfqd)
 	bfqd->hw_tag_samples = 0;
 }
 
+/*
+ * In latency-target mode, keep a running mean of the dispatch to
+ * completion time of each sync queue.  If a weight-raised queue, i.e.,
+ * an interactive or soft real-time application, goes above the target,
+ * throttle async dispatching for an async timeout.
+ */
+static void bfq_update_latency(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+			       struct request *rq)
+{
+	unsigned long lat = bfq_now_us() - RQ_DISP_US(rq);
+
+	if (bfqq->lat_samples == 0)
+		bfqq->lat_mean = lat;
+	else
+		bfqq->lat_mean = (7 * bfqq->lat_mean + lat) / 8;
+	if (bfqq->lat_samples < BFQ_HW_QUEUE_SAMPLES)
+		bfqq->lat_samples++;
+
+	if (bfqq->raising_coeff > 1 &&
+	    bfqq->lat_mean > bfqd->bfq_latency_target) {
+		bfqd->async_throttle_end =
+			(jiffies + bfqd->bfq_timeout[BLK_RW_ASYNC]) | 1;
+		bfq_log_bfqq(bfqd, bfqq, "latency %lu us over target",
+			     bfqq->lat_mean);
+	}
+}
+
 static void bfq_completed_request(struct request_queue *q, struct request *rq)
 {
 	struct bfq_queue *bfqq = RQ_BFQQ(rq);
@@ -1777,6 +1876,9 @@ static void bfq_completed_request(struct request_queue *q, struct request *rq)
 	if (sync)
 		RQ_CIC(rq)->last_end_request = jiffies;
 
+	if (sync && bfq_nonrot_mode(bfqd))
+		bfq_update_latency(bfqd, bfqq, rq);
+
 	/*
 	 * If this is the active queue, check if it needs to be expired,
 	 * or if we want to idle in case it has no pending requests.
@@ -2159,6 +2261,9 @@ static void *bfq_init_queue(struct request_queue *q)
 	bfqd->bfq_raising_min_idle_time = msecs_to_jiffies(2000);
 	bfqd->bfq_raising_max_softrt_rate = 7000;
 
+	bfqd->bfq_nonrot_mode = BFQ_NONROT_AUTO;
+	bfqd->bfq_latency_target = bfq_latency_target;
+
 	return bfqd;
 }
 
@@ -2249,6 +2354,8 @@ SHOW_FUNCTION(bfq_raising_min_idle_time_show, bfqd->bfq_raising_min_idle_time,
 	1);
 SHOW_FUNCTION(bfq_raising_max_softrt_rate_show,
 	bfqd->bfq_raising_max_softrt_rate, 0);
+SHOW_FUNCTION(bfq_nonrot_mode_show, bfqd->bfq_nonrot_mode, 0);
+SHOW_FUNCTION(bfq_latency_target_show, bfqd->bfq_latency_target, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -2289,6 +2396,10 @@ STORE_FUNCTION(bfq_raising_min_idle_time_store,
  	       &bfqd->bfq_raising_min_idle_time, 0, INT_MAX, 1);
 STORE_FUNCTION(bfq_raising_max_softrt_rate_store,
  	       &bfqd->bfq_raising_max_softrt_rate, 0, INT_MAX, 0);
+STORE_FUNCTION(bfq_nonrot_mode_store, &bfqd->bfq_nonrot_mode, 0,
+	       BFQ_NONROT_AUTO, 0);
+STORE_FUNCTION(bfq_latency_target_store, &bfqd->bfq_latency_target, 1,
+	       INT_MAX, 0);
 #undef STORE_FUNCTION
 
 /* do nothing for the moment */
@@ -2380,6 +2491,8 @@ static struct elv_fs_entry bfq_attrs[] = {
 	BFQ_ATTR(raising_max_time),
 	BFQ_ATTR(raising_min_idle_time),
 	BFQ_ATTR(raising_max_softrt_rate),
+	BFQ_ATTR(nonrot_mode),
+	BFQ_ATTR(latency_target),
 	BFQ_ATTR(weights),
 	__ATTR_NULL
 };
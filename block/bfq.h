@@ -214,6 +214,13 @@ struct bfq_group;
  *			       may be reactivated for a queue (in jiffies)
  * @bfq_raising_max_softrt_rate: max service-rate for a soft real-time queue,
  *			         sectors per seconds
+ * @bfq_nonrot_mode: latency-target mode for non-rotational devices: 0 off,
+ *		     1 on, 2 follow QUEUE_FLAG_NONROT of @queue.
+ * @bfq_latency_target: completion latency (usecs) that weight-raised sync
+ *			queues are kept under in latency-target mode.
+ * @async_throttle_end: async dispatching is throttled until this time
+ *			(jiffies), set when a weight-raised queue misses
+ *			@bfq_latency_target.
  *
  * All the fields are protected by the @queue lock.
  */
@@ -271,6 +278,11 @@ struct bfq_data {
 	unsigned int bfq_raising_max_time;
 	unsigned int bfq_raising_min_idle_time;
 	unsigned int bfq_raising_max_softrt_rate;
+
+	/* parameters of the latency-target (non-rotational) mode */
+	unsigned int bfq_nonrot_mode;
+	unsigned int bfq_latency_target;
+	unsigned long async_throttle_end;
 };
 
 /**
@@ -298,6 +310,8 @@ struct bfq_data {
  * @pid: pid of the process owning the queue, used for logging purposes.
  * @last_rais_start_time: last (idle -> weight-raised) transition attempt
  * @high_weight_budget: number of sectors left to serve with boosted weight
+ * @lat_samples: number of completion latencies sampled
+ * @lat_mean: mean dispatch-to-completion latency (usecs)
  *
  * A bfq_queue is a leaf request queue; it can be associated to an io_context
  * or more (if it is an async one).  @cgroup holds a reference to the
@@ -341,6 +355,9 @@ struct bfq_queue {
 	/* weight-raising fileds */
  	u64 last_rais_start_finish, soft_rt_next_start;
  	unsigned int raising_coeff;
+
+	unsigned int lat_samples;
+	unsigned long lat_mean;
 };
 
 enum bfqq_state_flags {
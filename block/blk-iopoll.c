@@ -17,7 +17,7 @@
 int blk_iopoll_enabled = 1;
 EXPORT_SYMBOL(blk_iopoll_enabled);
 
-static unsigned int blk_iopoll_budget __read_mostly = 256;
+int blk_iopoll_budget __read_mostly = 256;
 
 static DEFINE_PER_CPU(struct list_head, blk_cpu_iopoll);
 
@@ -189,6 +189,190 @@ void blk_iopoll_init(struct blk_iopoll *iop, int weight, blk_iopoll_fn *poll_fn)
 }
 EXPORT_SYMBOL(blk_iopoll_init);
 
+static int blk_iopoll_cq_poll(struct blk_iopoll *iop, int budget)
+{
+	struct blk_iopoll_cq *cq = container_of(iop, struct blk_iopoll_cq, iop);
+	struct request *rq;
+	struct bio *bio;
+	unsigned long flags;
+	int done = 0;
+
+	while (done < budget) {
+		LIST_HEAD(rqs);
+		struct bio_list bios;
+		int batch = 0;
+
+		bio_list_init(&bios);
+
+		spin_lock_irqsave(&cq->lock, flags);
+		while (done + batch < budget && !list_empty(&cq->rq_list)) {
+			list_move_tail(cq->rq_list.next, &rqs);
+			batch++;
+		}
+		while (done + batch < budget &&
+		       (bio = bio_list_pop(&cq->bio_list))) {
+			bio_list_add(&bios, bio);
+			batch++;
+		}
+		if (!batch) {
+			/*
+			 * Nothing left: leave polled mode under cq->lock,
+			 * so a racing blk_iopoll_end_request() either saw
+			 * us scheduled before or reschedules us now.
+			 */
+			__blk_iopoll_complete(iop);
+			spin_unlock_irqrestore(&cq->lock, flags);
+			break;
+		}
+		spin_unlock_irqrestore(&cq->lock, flags);
+
+		if (!list_empty(&rqs)) {
+			spin_lock_irqsave(cq->q->queue_lock, flags);
+			while (!list_empty(&rqs)) {
+				rq = list_entry_rq(rqs.next);
+				list_del_init(&rq->queuelist);
+				__blk_end_request_all(rq, rq->errors);
+			}
+			spin_unlock_irqrestore(cq->q->queue_lock, flags);
+		}
+
+		while ((bio = bio_list_pop(&bios)))
+			bio_endio(bio, 0);
+
+		done += batch;
+	}
+
+	return done;
+}
+
+/*
+ * Queue one completion on @cq and kick the softirq if it is not already
+ * polling. Returns 0 if the caller has to complete it inline instead:
+ * from process context the softirq would only run from ksoftirqd, a
+ * detour that costs more than ending the I/O right away.
+ */
+static int blk_iopoll_cq_queue(struct blk_iopoll_cq *cq, struct request *rq,
+			       struct bio *bio)
+{
+	unsigned long flags;
+
+	if (!blk_iopoll_enabled || !in_interrupt())
+		return 0;
+
+	spin_lock_irqsave(&cq->lock, flags);
+	if (test_bit(IOPOLL_F_DISABLE, &cq->iop.state)) {
+		spin_unlock_irqrestore(&cq->lock, flags);
+		return 0;
+	}
+	if (rq)
+		list_add_tail(&rq->queuelist, &cq->rq_list);
+	else
+		bio_list_add(&cq->bio_list, bio);
+	if (!blk_iopoll_sched_prep(&cq->iop))
+		blk_iopoll_sched(&cq->iop);
+	spin_unlock_irqrestore(&cq->lock, flags);
+
+	return 1;
+}
+
+/**
+ * blk_iopoll_end_request - Complete a request through a completion queue
+ * @cq:       The completion queue of the device
+ * @rq:       The request, fully transferred
+ * @error:    0 for success, < 0 for error
+ *
+ * Description:
+ *     Ends all of @rq, either later from the iopoll softirq together with
+ *     other completed requests, or right away if iopoll is disabled or
+ *     the caller is not in interrupt context. Must be called without the
+ *     queue lock held.
+ **/
+void blk_iopoll_end_request(struct blk_iopoll_cq *cq, struct request *rq,
+			    int error)
+{
+	unsigned long flags;
+
+	rq->errors = error;
+	if (blk_iopoll_cq_queue(cq, rq, NULL))
+		return;
+
+	spin_lock_irqsave(cq->q->queue_lock, flags);
+	__blk_end_request_all(rq, error);
+	spin_unlock_irqrestore(cq->q->queue_lock, flags);
+}
+EXPORT_SYMBOL(blk_iopoll_end_request);
+
+/**
+ * blk_iopoll_bio_endio - Complete a bio through a completion queue
+ * @cq:       The completion queue of the device
+ * @bio:      The bio
+ * @error:    0 for success, < 0 for error
+ *
+ * Description:
+ *     The bio_endio() counterpart of blk_iopoll_end_request() for bio
+ *     based drivers. A deferred failure is reported as -EIO.
+ **/
+void blk_iopoll_bio_endio(struct blk_iopoll_cq *cq, struct bio *bio, int error)
+{
+	if (error)
+		clear_bit(BIO_UPTODATE, &bio->bi_flags);
+	if (!blk_iopoll_cq_queue(cq, NULL, bio))
+		bio_endio(bio, error);
+}
+EXPORT_SYMBOL(blk_iopoll_bio_endio);
+
+/**
+ * blk_iopoll_cq_init - Initialize a completion queue
+ * @cq:       The completion queue
+ * @q:        The request queue the requests end on, NULL for bios only
+ * @weight:   Completions ended per poll run before yielding
+ **/
+void blk_iopoll_cq_init(struct blk_iopoll_cq *cq, struct request_queue *q,
+			int weight)
+{
+	blk_iopoll_init(&cq->iop, weight, blk_iopoll_cq_poll);
+	spin_lock_init(&cq->lock);
+	cq->q = q;
+	INIT_LIST_HEAD(&cq->rq_list);
+	bio_list_init(&cq->bio_list);
+	blk_iopoll_enable(&cq->iop);
+}
+EXPORT_SYMBOL(blk_iopoll_cq_init);
+
+/**
+ * blk_iopoll_cq_drain - Wait for the completions queued on @cq
+ * @cq:       The completion queue
+ *
+ * Description:
+ *     Waits until everything handed to @cq so far has been ended. May
+ *     sleep.
+ **/
+void blk_iopoll_cq_drain(struct blk_iopoll_cq *cq)
+{
+	while (test_bit(IOPOLL_F_SCHED, &cq->iop.state) &&
+	       !test_bit(IOPOLL_F_DISABLE, &cq->iop.state))
+		msleep(1);
+}
+EXPORT_SYMBOL(blk_iopoll_cq_drain);
+
+/**
+ * blk_iopoll_cq_destroy - Shut down a completion queue
+ * @cq:       The completion queue
+ *
+ * Description:
+ *     Ends what is still queued on @cq; later completions are ended
+ *     inline. The caller must make sure nothing is completed
+ *     concurrently. May sleep.
+ **/
+void blk_iopoll_cq_destroy(struct blk_iopoll_cq *cq)
+{
+	blk_iopoll_cq_drain(cq);
+	set_bit(IOPOLL_F_DISABLE, &cq->iop.state);
+	while (test_and_set_bit(IOPOLL_F_SCHED, &cq->iop.state))
+		msleep(1);
+}
+EXPORT_SYMBOL(blk_iopoll_cq_destroy);
+
 static int __cpuinit blk_iopoll_cpu_notify(struct notifier_block *self,
 					  unsigned long action, void *hcpu)
 {
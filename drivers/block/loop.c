@@ -82,6 +82,7 @@ static DEFINE_MUTEX(loop_devices_mutex);
 
 static int max_part;
 static int part_shift;
+static int iopoll_weight = 32;
 
 /*
  * Transfer functions
@@ -507,6 +508,281 @@ out:
 	return ret;
 }
 
+/*
+ * Direct I/O mode: bios are remapped through bmap() to the blocks of
+ * the backing file and sent straight to the device underneath, like
+ * swap to a swap file. This skips the page cache of the backing file
+ * and keeps as many bios in flight as the upper layers send.
+ *
+ * Like swapon(), the mode relies on the block map not changing under
+ * it: the file must be fully allocated with plain written extents, and
+ * it is pinned with S_SWAPFILE for as long as the mode is on, so that
+ * truncate and extent moving are refused.
+ */
+struct loop_dio {
+	struct loop_device *lo;
+	struct bio *orig;
+	atomic_t remaining;
+	int error;
+};
+
+static int loop_dio_capable(struct file *file, loff_t offset)
+{
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+
+	return S_ISREG(inode->i_mode) && mapping->a_ops->bmap &&
+	       inode->i_op->fiemap && inode->i_sb->s_bdev && !(offset & 511);
+}
+
+#define LOOP_DIO_EXTENTS	32
+#define LOOP_DIO_BAD_EXTENT	(FIEMAP_EXTENT_UNKNOWN | \
+				 FIEMAP_EXTENT_DELALLOC | \
+				 FIEMAP_EXTENT_ENCODED | \
+				 FIEMAP_EXTENT_NOT_ALIGNED | \
+				 FIEMAP_EXTENT_UNWRITTEN)
+
+/*
+ * bmap() happily maps holes to nothing and unwritten extents to blocks
+ * holding stale data, so walk the extent map and refuse both.
+ */
+static int loop_dio_check_extents(struct inode *inode)
+{
+	struct fiemap_extent_info fieinfo;
+	struct fiemap_extent *ext;
+	u64 start = 0, size = i_size_read(inode);
+	mm_segment_t old_fs;
+	int i, err;
+
+	err = filemap_write_and_wait(inode->i_mapping);
+	if (err)
+		return err;
+
+	ext = kmalloc(LOOP_DIO_EXTENTS * sizeof(*ext), GFP_KERNEL);
+	if (!ext)
+		return -ENOMEM;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (start < size) {
+		memset(&fieinfo, 0, sizeof(fieinfo));
+		fieinfo.fi_extents_max = LOOP_DIO_EXTENTS;
+		fieinfo.fi_extents_start = (struct fiemap_extent __user *)ext;
+		err = inode->i_op->fiemap(inode, &fieinfo, start, size - start);
+		if (err)
+			break;
+		err = -EINVAL;
+		if (!fieinfo.fi_extents_mapped)
+			break;
+		for (i = 0; i < fieinfo.fi_extents_mapped; i++) {
+			u64 end = ext[i].fe_logical + ext[i].fe_length;
+
+			if (ext[i].fe_logical > start || end <= start ||
+			    (ext[i].fe_flags & LOOP_DIO_BAD_EXTENT))
+				goto out;
+			start = end;
+		}
+		err = 0;
+	}
+out:
+	set_fs(old_fs);
+	kfree(ext);
+	return err;
+}
+
+/*
+ * Pin the block map of the backing file. The flag goes on first so
+ * that nothing can truncate the file while its extents are checked.
+ */
+static int loop_dio_pin(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	int err;
+
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode)) {
+		mutex_unlock(&inode->i_mutex);
+		return -EBUSY;
+	}
+	inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+
+	err = loop_dio_check_extents(inode);
+	if (err) {
+		mutex_lock(&inode->i_mutex);
+		inode->i_flags &= ~S_SWAPFILE;
+		mutex_unlock(&inode->i_mutex);
+	}
+	return err;
+}
+
+static void loop_dio_unpin(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+}
+
+/*
+ * Write back and drop cached pages of the backing file in the range,
+ * so that I/O bypassing the page cache neither misses dirty data nor
+ * leaves stale copies behind.
+ */
+static void loop_dio_sync_range(struct loop_device *lo, loff_t pos,
+				unsigned int len)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+
+	if (!mapping->nrpages)
+		return;
+	filemap_write_and_wait_range(mapping, pos, pos + len - 1);
+	invalidate_inode_pages2_range(mapping, pos >> PAGE_CACHE_SHIFT,
+				      (pos + len - 1) >> PAGE_CACHE_SHIFT);
+}
+
+static void loop_dio_wait(struct loop_device *lo)
+{
+	wait_event(lo->lo_event, !atomic_read(&lo->lo_dio_inflight));
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (atomic_dec_and_test(&dio->remaining)) {
+		/* batched when the last clone ends in interrupt context */
+		blk_iopoll_bio_endio(&lo->lo_cq, dio->orig, dio->error);
+		kfree(dio);
+		if (atomic_dec_and_test(&lo->lo_dio_inflight))
+			wake_up(&lo->lo_event);
+	}
+}
+
+static void loop_dio_end_io(struct bio *bio, int error)
+{
+	struct loop_dio *dio = bio->bi_private;
+
+	if (error)
+		dio->error = error;
+	bio_put(bio);
+	loop_dio_put(dio);
+}
+
+/*
+ * Build the bios for @bio on the underlying device, one per physically
+ * contiguous run of file blocks. Returns -ENODATA if part of the range
+ * is a hole, which loop_dio_pin() should have ruled out.
+ */
+static int loop_dio_map(struct loop_device *lo, struct bio *bio,
+			struct loop_dio *dio, struct bio_list *list)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+	unsigned int blkbits = inode->i_blkbits;
+	loff_t pos = ((loff_t) bio->bi_sector << 9) + lo->lo_offset;
+	struct bio *clone = NULL;
+	struct bio_vec *bvec;
+	sector_t next = 0;
+	int i;
+
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned int off = bvec->bv_offset;
+		unsigned int left = bvec->bv_len;
+
+		while (left) {
+			unsigned int in_blk = pos & ((1 << blkbits) - 1);
+			unsigned int len = min(left, (1U << blkbits) - in_blk);
+			sector_t phys, sector;
+
+			phys = bmap(inode, pos >> blkbits);
+			if (!phys)
+				return -ENODATA;
+			sector = (phys << (blkbits - 9)) + (in_blk >> 9);
+
+			if (!clone || sector != next ||
+			    bio_add_page(clone, bvec->bv_page, len, off) < len) {
+				clone = bio_alloc(GFP_NOIO, bio_segments(bio));
+				clone->bi_bdev = inode->i_sb->s_bdev;
+				clone->bi_sector = sector;
+				clone->bi_rw = bio->bi_rw;
+				clone->bi_end_io = loop_dio_end_io;
+				clone->bi_private = dio;
+				bio_list_add(list, clone);
+				if (bio_add_page(clone, bvec->bv_page, len,
+						 off) < len)
+					return -EIO;
+			}
+
+			next = sector + (len >> 9);
+			pos += len;
+			off += len;
+			left -= len;
+		}
+	}
+
+	return 0;
+}
+
+static void do_bio_direct(struct loop_device *lo, struct bio *bio)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+	loff_t pos = ((loff_t) bio->bi_sector << 9) + lo->lo_offset;
+	unsigned int len = bio->bi_size;
+	struct bio_list list;
+	struct loop_dio *dio;
+	struct bio *clone;
+	int ret;
+
+	if (bio->bi_rw & REQ_HARDBARRIER) {
+		/*
+		 * Everything before the barrier must be stable; the write
+		 * itself goes through the fsync()ing buffered path.
+		 */
+		loop_dio_wait(lo);
+		blkdev_issue_flush(inode->i_sb->s_bdev, GFP_KERNEL, NULL,
+				   BLKDEV_IFL_WAIT);
+		goto fallback;
+	}
+
+	dio = kmalloc(sizeof(*dio), GFP_NOIO);
+	if (!dio)
+		goto fallback;
+
+	bio_list_init(&list);
+	ret = loop_dio_map(lo, bio, dio, &list);
+	if (ret) {
+		while ((clone = bio_list_pop(&list)))
+			bio_put(clone);
+		kfree(dio);
+		if (ret != -ENODATA) {
+			bio_endio(bio, ret);
+			return;
+		}
+		goto fallback;
+	}
+
+	loop_dio_sync_range(lo, pos, len);
+
+	dio->lo = lo;
+	dio->orig = bio;
+	dio->error = 0;
+	atomic_set(&dio->remaining, 1);
+	atomic_inc(&lo->lo_dio_inflight);
+	while ((clone = bio_list_pop(&list))) {
+		atomic_inc(&dio->remaining);
+		generic_make_request(clone);
+	}
+	/* drop the submission reference */
+	loop_dio_put(dio);
+	return;
+
+fallback:
+	ret = do_bio_filebacked(lo, bio);
+	loop_dio_sync_range(lo, pos, len);
+	bio_endio(bio, ret);
+}
+
 /*
  * Add bio to back of pending list
  */
@@ -572,6 +848,8 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 	if (unlikely(!bio->bi_bdev)) {
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
+	} else if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		do_bio_direct(lo, bio);
 	} else {
 		int ret = do_bio_filebacked(lo, bio);
 		bio_endio(bio, ret);
@@ -613,6 +891,7 @@ static int loop_thread(void *data)
 		loop_handle_bio(lo, bio);
 	}
 
+	loop_dio_wait(lo);
 	return 0;
 }
 
@@ -657,6 +936,9 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	struct file *old_file = lo->lo_backing_file;
 	struct address_space *mapping;
 
+	/* bios sent around the page cache count as queued too */
+	loop_dio_wait(lo);
+
 	/* if no new file, only flush of queued bios requested */
 	if (!file)
 		goto out;
@@ -664,6 +946,12 @@ static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
 	mapping = file->f_mapping;
 	mapping_set_gfp_mask(old_file->f_mapping, lo->old_gfp_mask);
 	lo->lo_backing_file = file;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		loop_dio_unpin(old_file);
+		if (!loop_dio_capable(file, lo->lo_offset) ||
+		    loop_dio_pin(file))
+			lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	}
 	lo->lo_blocksize = S_ISBLK(mapping->host->i_mode) ?
 		mapping->host->i_bdev->bd_block_size : PAGE_SIZE;
 	lo->old_gfp_mask = mapping_gfp_mask(mapping);
@@ -928,6 +1216,10 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 	spin_unlock_irq(&lo->lo_lock);
 
 	kthread_stop(lo->lo_thread);
+	blk_iopoll_cq_drain(&lo->lo_cq);
+
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		loop_dio_unpin(filp);
 
 	lo->lo_queue->unplug_fn = NULL;
 	lo->lo_backing_file = NULL;
@@ -976,6 +1268,8 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	int err;
 	struct loop_func_table *xfer;
 	uid_t uid = current_uid();
+	int dio = info->lo_flags & LO_FLAGS_DIRECT_IO;
+	int pinned = 0;
 
 	if (lo->lo_encrypt_key_size &&
 	    lo->lo_key_owner != uid &&
@@ -985,32 +1279,44 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	if (dio && (info->lo_encrypt_type ||
+		    !loop_dio_capable(lo->lo_backing_file, info->lo_offset)))
+		return -EINVAL;
+
+	if (dio && !(lo->lo_flags & LO_FLAGS_DIRECT_IO)) {
+		err = loop_dio_pin(lo->lo_backing_file);
+		if (err)
+			return err;
+		pinned = 1;
+	}
 
 	err = loop_release_xfer(lo);
 	if (err)
-		return err;
+		goto out_unpin;
 
 	if (info->lo_encrypt_type) {
 		unsigned int type = info->lo_encrypt_type;
 
+		err = -EINVAL;
 		if (type >= MAX_LO_CRYPT)
-			return -EINVAL;
+			goto out_unpin;
 		xfer = xfer_funcs[type];
 		if (xfer == NULL)
-			return -EINVAL;
+			goto out_unpin;
 	} else
 		xfer = NULL;
 
 	err = loop_init_xfer(lo, xfer, info);
 	if (err)
-		return err;
+		goto out_unpin;
 
 	if (lo->lo_offset != info->lo_offset ||
 	    lo->lo_sizelimit != info->lo_sizelimit) {
 		lo->lo_offset = info->lo_offset;
 		lo->lo_sizelimit = info->lo_sizelimit;
+		err = -EFBIG;
 		if (figure_loop_size(lo))
-			return -EFBIG;
+			goto out_unpin;
 	}
 
 	memcpy(lo->lo_file_name, info->lo_file_name, LO_NAME_SIZE);
@@ -1027,6 +1333,24 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	     (info->lo_flags & LO_FLAGS_AUTOCLEAR))
 		lo->lo_flags ^= LO_FLAGS_AUTOCLEAR;
 
+	if (dio)
+		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	else if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		/*
+		 * loop_thread may have tested the flag and mapped a bio
+		 * without counting it in flight yet.  Push a flush through
+		 * the thread, so all such bios are sent and completed
+		 * before the pin comes off.
+		 */
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+		err = loop_flush(lo);
+		if (err) {
+			lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+			return err;
+		}
+		loop_dio_unpin(lo->lo_backing_file);
+	}
+
 	lo->lo_encrypt_key_size = info->lo_encrypt_key_size;
 	lo->lo_init[0] = info->lo_init[0];
 	lo->lo_init[1] = info->lo_init[1];
@@ -1037,6 +1361,11 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	}	
 
 	return 0;
+
+out_unpin:
+	if (pinned)
+		loop_dio_unpin(lo->lo_backing_file);
+	return err;
 }
 
 static int
@@ -1470,6 +1799,8 @@ module_param(max_loop, int, 0);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+module_param(iopoll_weight, int, 0444);
+MODULE_PARM_DESC(iopoll_weight, "Bios completed per blk-iopoll run");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1531,6 +1862,8 @@ static struct loop_device *loop_alloc(int i)
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
 	spin_lock_init(&lo->lo_lock);
+	atomic_set(&lo->lo_dio_inflight, 0);
+	blk_iopoll_cq_init(&lo->lo_cq, NULL, max(iopoll_weight, 1));
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
 	disk->fops		= &lo_fops;
@@ -1549,6 +1882,7 @@ out:
 
 static void loop_free(struct loop_device *lo)
 {
+	blk_iopoll_cq_destroy(&lo->lo_cq);
 	blk_cleanup_queue(lo->lo_queue);
 	put_disk(lo->lo_disk);
 	list_del(&lo->lo_list);
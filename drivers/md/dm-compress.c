@@ -0,0 +1,602 @@
+/*
+ * A read-only target that serves a device from an image of LZO or
+ * zlib compressed chunks, with a cache of decompressed chunks.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+#include <linux/lzo.h>
+#include <linux/zlib.h>
+#include <linux/dm-io.h>
+
+#include <linux/device-mapper.h>
+
+#define DM_MSG_PREFIX "compress"
+
+/*
+ * On-disk layout, all little-endian:
+ *
+ *   sector 0:		struct dmcz_super
+ *   index_start:	nr_chunks + 1 __le64 byte offsets; chunk i is
+ *			stored in [index[i], index[i + 1]), and is kept
+ *			uncompressed if that is as long as the chunk.
+ */
+#define DMCZ_MAGIC		0x5a434d44	/* "DMCZ" */
+#define DMCZ_VERSION		1
+
+#define DMCZ_ALG_LZO		1
+#define DMCZ_ALG_ZLIB		2
+
+#define DMCZ_MIN_CHUNK_SHIFT	12
+#define DMCZ_MAX_CHUNK_SHIFT	20
+
+#define DMCZ_DEFAULT_CACHE	32
+
+struct dmcz_super {
+	__le32 magic;
+	__le32 version;
+	__le32 algorithm;
+	__le32 chunk_shift;
+	__le64 size;		/* uncompressed, in sectors */
+	__le64 index_start;	/* in sectors */
+} __packed;
+
+struct dmcz_chunk {
+	struct list_head lru;
+	struct hlist_node hash;
+	u64 nr;
+	void *data;
+};
+
+struct dmcz_c {
+	struct dm_dev *dev;
+	sector_t start;
+
+	unsigned algorithm;
+	unsigned chunk_shift;
+	u64 size;		/* uncompressed, in bytes */
+	u64 nr_chunks;
+	u64 *index;
+	sector_t disk_len;	/* sectors of the image in use on the device */
+
+	struct dm_io_client *io_client;
+	void *cbuf;		/* compressed chunk as read from disk */
+	z_stream zstream;
+
+	/* decompressed chunks, protected by work being single threaded */
+	unsigned nr_cached;
+	struct dmcz_chunk *cache;
+	struct list_head lru;
+	struct hlist_head *hash;
+	unsigned hash_mask;
+
+	struct workqueue_struct *wq;
+	struct work_struct work;
+	spinlock_t lock;
+	struct bio_list bios;
+
+	unsigned long long hits;
+	unsigned long long misses;
+};
+
+static int dmcz_read(struct dmcz_c *cc, sector_t sector, sector_t count,
+		     void *buf)
+{
+	struct dm_io_region region = {
+		.bdev = cc->dev->bdev,
+		.sector = cc->start + sector,
+		.count = count,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = READ,
+		.mem.type = is_vmalloc_addr(buf) ? DM_IO_VMA : DM_IO_KMEM,
+		.mem.ptr.addr = buf,
+		.notify.fn = NULL,
+		.client = cc->io_client,
+	};
+
+	return dm_io(&io_req, 1, &region, NULL);
+}
+
+static size_t dmcz_chunk_bytes(struct dmcz_c *cc, u64 nr)
+{
+	u64 start = nr << cc->chunk_shift;
+
+	return min_t(u64, 1 << cc->chunk_shift, cc->size - start);
+}
+
+static int dmcz_inflate(struct dmcz_c *cc, void *src, size_t src_len,
+			void *dst, size_t dst_len)
+{
+	z_stream *stream = &cc->zstream;
+	int r;
+
+	if (cc->algorithm == DMCZ_ALG_LZO) {
+		size_t len = dst_len;
+
+		r = lzo1x_decompress_safe(src, src_len, dst, &len);
+		return (r == LZO_E_OK && len == dst_len) ? 0 : -EIO;
+	}
+
+	stream->next_in = src;
+	stream->avail_in = src_len;
+	stream->next_out = dst;
+	stream->avail_out = dst_len;
+	if (zlib_inflateInit(stream) != Z_OK)
+		return -EIO;
+	r = zlib_inflate(stream, Z_FINISH);
+	zlib_inflateEnd(stream);
+
+	return (r == Z_STREAM_END && stream->total_out == dst_len) ? 0 : -EIO;
+}
+
+static int dmcz_load_chunk(struct dmcz_c *cc, u64 nr, void *dst)
+{
+	u64 off = cc->index[nr];
+	size_t clen = cc->index[nr + 1] - off;
+	size_t len = dmcz_chunk_bytes(cc, nr);
+	sector_t sector = off >> SECTOR_SHIFT;
+	sector_t count = ((off + clen + (1 << SECTOR_SHIFT) - 1) >>
+			  SECTOR_SHIFT) - sector;
+	void *src = cc->cbuf + (off & ((1 << SECTOR_SHIFT) - 1));
+	int r;
+
+	r = dmcz_read(cc, sector, count, cc->cbuf);
+	if (r)
+		return r;
+
+	if (clen == len) {
+		memcpy(dst, src, len);
+		return 0;
+	}
+
+	r = dmcz_inflate(cc, src, clen, dst, len);
+	if (r)
+		DMERR_LIMIT("chunk %llu is corrupt", (unsigned long long)nr);
+
+	return r;
+}
+
+static struct dmcz_chunk *dmcz_get_chunk(struct dmcz_c *cc, u64 nr)
+{
+	struct hlist_head *head = &cc->hash[nr & cc->hash_mask];
+	struct hlist_node *pos;
+	struct dmcz_chunk *c;
+
+	hlist_for_each_entry(c, pos, head, hash) {
+		if (c->nr == nr) {
+			cc->hits++;
+			list_move(&c->lru, &cc->lru);
+			return c;
+		}
+	}
+
+	cc->misses++;
+	c = list_entry(cc->lru.prev, struct dmcz_chunk, lru);
+	if (!hlist_unhashed(&c->hash))
+		hlist_del_init(&c->hash);
+
+	if (dmcz_load_chunk(cc, nr, c->data))
+		return NULL;
+
+	c->nr = nr;
+	hlist_add_head(&c->hash, head);
+	list_move(&c->lru, &cc->lru);
+
+	return c;
+}
+
+static int dmcz_copy_bio(struct dmcz_c *cc, struct bio *bio, u64 pos)
+{
+	u64 chunk_mask = (1 << cc->chunk_shift) - 1;
+	struct bio_vec *bvec;
+	int i;
+
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned offset = bvec->bv_offset;
+		unsigned left = bvec->bv_len;
+
+		while (left) {
+			struct dmcz_chunk *c;
+			unsigned off = pos & chunk_mask;
+			unsigned len = min_t(unsigned, left,
+					     chunk_mask + 1 - off);
+			char *dst;
+
+			c = dmcz_get_chunk(cc, pos >> cc->chunk_shift);
+			if (!c)
+				return -EIO;
+
+			dst = kmap(bvec->bv_page);
+			memcpy(dst + offset, c->data + off, len);
+			kunmap(bvec->bv_page);
+			flush_dcache_page(bvec->bv_page);
+
+			pos += len;
+			offset += len;
+			left -= len;
+		}
+	}
+
+	return 0;
+}
+
+static void dmcz_work(struct work_struct *work)
+{
+	struct dmcz_c *cc = container_of(work, struct dmcz_c, work);
+	struct bio_list bios;
+	struct bio *bio;
+	u64 pos;
+
+	spin_lock_irq(&cc->lock);
+	bios = cc->bios;
+	bio_list_init(&cc->bios);
+	spin_unlock_irq(&cc->lock);
+
+	while ((bio = bio_list_pop(&bios))) {
+		pos = (u64)bio->bi_sector << SECTOR_SHIFT;
+		bio_endio(bio, dmcz_copy_bio(cc, bio, pos));
+	}
+}
+
+/*
+ * Bytes of the device available to the image, from cc->start on.
+ */
+static u64 dmcz_dev_bytes(struct dmcz_c *cc)
+{
+	u64 dev_size = i_size_read(cc->dev->bdev->bd_inode);
+	u64 start = (u64)cc->start << SECTOR_SHIFT;
+
+	return dev_size > start ? dev_size - start : 0;
+}
+
+static int dmcz_read_index(struct dmcz_c *cc, sector_t index_start)
+{
+	u64 avail = dmcz_dev_bytes(cc);
+	size_t bytes;
+	__le64 *raw;
+	u64 i;
+	int r;
+
+	/*
+	 * The index itself has to fit on the device, which also keeps
+	 * the allocation below from overflowing.
+	 */
+	if (cc->nr_chunks >= avail / sizeof(__le64) ||
+	    cc->nr_chunks >= ~(size_t)0 / sizeof(__le64) - 1)
+		return -EINVAL;
+	bytes = (cc->nr_chunks + 1) * sizeof(__le64);
+	if ((u64)index_start > avail >> SECTOR_SHIFT ||
+	    bytes > avail - ((u64)index_start << SECTOR_SHIFT))
+		return -EINVAL;
+
+	cc->index = vmalloc(round_up(bytes, 1 << SECTOR_SHIFT));
+	if (!cc->index)
+		return -ENOMEM;
+
+	r = dmcz_read(cc, index_start,
+		      round_up(bytes, 1 << SECTOR_SHIFT) >> SECTOR_SHIFT,
+		      cc->index);
+	if (r)
+		return r;
+
+	raw = (__le64 *)cc->index;
+	for (i = 0; i <= cc->nr_chunks; i++) {
+		cc->index[i] = le64_to_cpu(raw[i]);
+		/* offsets are relative to cc->start, like all our reads */
+		if (cc->index[i] > avail)
+			return -EINVAL;
+		if (i && (cc->index[i] < cc->index[i - 1] ||
+			  cc->index[i] - cc->index[i - 1] >
+			  dmcz_chunk_bytes(cc, i - 1)))
+			return -EINVAL;
+	}
+
+	cc->disk_len = (max_t(u64, cc->index[cc->nr_chunks],
+			      ((u64)index_start << SECTOR_SHIFT) + bytes) +
+			(1 << SECTOR_SHIFT) - 1) >> SECTOR_SHIFT;
+
+	return 0;
+}
+
+static int dmcz_read_super(struct dm_target *ti, struct dmcz_c *cc)
+{
+	struct dmcz_super *sb;
+	sector_t index_start;
+	int r;
+
+	sb = kmalloc(1 << SECTOR_SHIFT, GFP_KERNEL);
+	if (!sb) {
+		ti->error = "Cannot allocate superblock";
+		return -ENOMEM;
+	}
+
+	r = dmcz_read(cc, 0, 1, sb);
+	if (r) {
+		ti->error = "Cannot read superblock";
+		goto out;
+	}
+
+	r = -EINVAL;
+	if (le32_to_cpu(sb->magic) != DMCZ_MAGIC ||
+	    le32_to_cpu(sb->version) != DMCZ_VERSION) {
+		ti->error = "Not a compressed image";
+		goto out;
+	}
+
+	cc->algorithm = le32_to_cpu(sb->algorithm);
+	if (cc->algorithm != DMCZ_ALG_LZO && cc->algorithm != DMCZ_ALG_ZLIB) {
+		ti->error = "Unknown compression algorithm";
+		goto out;
+	}
+
+	cc->chunk_shift = le32_to_cpu(sb->chunk_shift);
+	if (cc->chunk_shift < DMCZ_MIN_CHUNK_SHIFT ||
+	    cc->chunk_shift > DMCZ_MAX_CHUNK_SHIFT) {
+		ti->error = "Invalid chunk size";
+		goto out;
+	}
+
+	if (le64_to_cpu(sb->size) > (~0ULL >> SECTOR_SHIFT)) {
+		ti->error = "Invalid image size";
+		goto out;
+	}
+	cc->size = le64_to_cpu(sb->size) << SECTOR_SHIFT;
+	if (ti->len > cc->size >> SECTOR_SHIFT) {
+		ti->error = "Target is larger than the image";
+		goto out;
+	}
+	cc->nr_chunks = (cc->size + (1 << cc->chunk_shift) - 1) >>
+			cc->chunk_shift;
+	index_start = le64_to_cpu(sb->index_start);
+	r = 0;
+
+out:
+	kfree(sb);
+	if (r)
+		return r;
+
+	r = dmcz_read_index(cc, index_start);
+	if (r)
+		ti->error = "Cannot read chunk index";
+
+	return r;
+}
+
+static int dmcz_alloc_cache(struct dmcz_c *cc)
+{
+	unsigned i;
+
+	cc->cache = kcalloc(cc->nr_cached, sizeof(*cc->cache), GFP_KERNEL);
+	cc->hash = kcalloc(roundup_pow_of_two(cc->nr_cached),
+			   sizeof(*cc->hash), GFP_KERNEL);
+	if (!cc->cache || !cc->hash)
+		return -ENOMEM;
+
+	cc->hash_mask = roundup_pow_of_two(cc->nr_cached) - 1;
+	INIT_LIST_HEAD(&cc->lru);
+	for (i = 0; i < cc->nr_cached; i++) {
+		struct dmcz_chunk *c = &cc->cache[i];
+
+		c->data = vmalloc(1 << cc->chunk_shift);
+		if (!c->data)
+			return -ENOMEM;
+		INIT_HLIST_NODE(&c->hash);
+		list_add(&c->lru, &cc->lru);
+	}
+
+	return 0;
+}
+
+static void dmcz_free(struct dmcz_c *cc)
+{
+	unsigned i;
+
+	if (cc->wq)
+		destroy_workqueue(cc->wq);
+	if (cc->cache)
+		for (i = 0; i < cc->nr_cached; i++)
+			vfree(cc->cache[i].data);
+	kfree(cc->cache);
+	kfree(cc->hash);
+	vfree(cc->zstream.workspace);
+	vfree(cc->cbuf);
+	vfree(cc->index);
+	if (cc->io_client)
+		dm_io_client_destroy(cc->io_client);
+	kfree(cc);
+}
+
+/*
+ * Construct a compressed mapping: <dev_path> <offset> [<cache_chunks>]
+ */
+static int dmcz_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct dmcz_c *cc;
+	unsigned long long tmpll;
+	size_t cbuf_size;
+	int r = -EINVAL;
+
+	if (argc != 2 && argc != 3) {
+		ti->error = "requires 2 or 3 arguments";
+		return -EINVAL;
+	}
+
+	cc = kzalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc) {
+		ti->error = "Cannot allocate context";
+		return -ENOMEM;
+	}
+
+	if (sscanf(argv[1], "%llu", &tmpll) != 1) {
+		ti->error = "Invalid device sector";
+		goto bad;
+	}
+	cc->start = tmpll;
+
+	cc->nr_cached = DMCZ_DEFAULT_CACHE;
+	if (argc == 3 && (sscanf(argv[2], "%u", &cc->nr_cached) != 1 ||
+			  !cc->nr_cached)) {
+		ti->error = "Invalid cache size";
+		goto bad;
+	}
+
+	if (dm_get_device(ti, argv[0], FMODE_READ, &cc->dev)) {
+		ti->error = "Device lookup failed";
+		goto bad;
+	}
+
+	r = -ENOMEM;
+	cc->io_client = dm_io_client_create((1 << (DMCZ_MAX_CHUNK_SHIFT -
+						   PAGE_SHIFT)) + 2);
+	if (IS_ERR(cc->io_client)) {
+		r = PTR_ERR(cc->io_client);
+		cc->io_client = NULL;
+		ti->error = "Cannot create io client";
+		goto bad_dev;
+	}
+
+	r = dmcz_read_super(ti, cc);
+	if (r)
+		goto bad_dev;
+
+	r = -ENOMEM;
+	/* a chunk never starts or ends on a sector boundary for sure */
+	cbuf_size = (1 << cc->chunk_shift) + 2 * (1 << SECTOR_SHIFT);
+	cc->cbuf = vmalloc(cbuf_size);
+	if (!cc->cbuf) {
+		ti->error = "Cannot allocate read buffer";
+		goto bad_dev;
+	}
+
+	if (cc->algorithm == DMCZ_ALG_ZLIB) {
+		cc->zstream.workspace = vmalloc(zlib_inflate_workspacesize());
+		if (!cc->zstream.workspace) {
+			ti->error = "Cannot allocate zlib workspace";
+			goto bad_dev;
+		}
+	}
+
+	if (dmcz_alloc_cache(cc)) {
+		ti->error = "Cannot allocate chunk cache";
+		goto bad_dev;
+	}
+
+	cc->wq = create_singlethread_workqueue("kcompressd");
+	if (!cc->wq) {
+		ti->error = "Cannot create workqueue";
+		goto bad_dev;
+	}
+	INIT_WORK(&cc->work, dmcz_work);
+	spin_lock_init(&cc->lock);
+	bio_list_init(&cc->bios);
+
+	ti->private = cc;
+	return 0;
+
+bad_dev:
+	dm_put_device(ti, cc->dev);
+bad:
+	dmcz_free(cc);
+	return r;
+}
+
+static void dmcz_dtr(struct dm_target *ti)
+{
+	struct dmcz_c *cc = ti->private;
+
+	flush_workqueue(cc->wq);
+	dm_put_device(ti, cc->dev);
+	dmcz_free(cc);
+}
+
+static int dmcz_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct dmcz_c *cc = ti->private;
+	unsigned long flags;
+
+	if (bio_data_dir(bio) == WRITE)
+		return -EROFS;
+
+	bio->bi_sector = dm_target_offset(ti, bio->bi_sector);
+
+	spin_lock_irqsave(&cc->lock, flags);
+	bio_list_add(&cc->bios, bio);
+	spin_unlock_irqrestore(&cc->lock, flags);
+
+	queue_work(cc->wq, &cc->work);
+
+	return DM_MAPIO_SUBMITTED;
+}
+
+static int dmcz_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned maxlen)
+{
+	struct dmcz_c *cc = ti->private;
+	int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("%llu %llu", cc->hits, cc->misses);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %llu %u", cc->dev->name,
+		       (unsigned long long)cc->start, cc->nr_cached);
+		break;
+	}
+
+	return 0;
+}
+
+static int dmcz_iterate_devices(struct dm_target *ti,
+				iterate_devices_callout_fn fn, void *data)
+{
+	struct dmcz_c *cc = ti->private;
+
+	/* the compressed image is shorter than the target it provides */
+	return fn(ti, cc->dev, cc->start, cc->disk_len, data);
+}
+
+static struct target_type compress_target = {
+	.name	     = "compress",
+	.version     = {1, 0, 0},
+	.module      = THIS_MODULE,
+	.ctr	     = dmcz_ctr,
+	.dtr	     = dmcz_dtr,
+	.map	     = dmcz_map,
+	.status	     = dmcz_status,
+	.iterate_devices = dmcz_iterate_devices,
+};
+
+static int __init dm_compress_init(void)
+{
+	int r = dm_register_target(&compress_target);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	return r;
+}
+
+static void __exit dm_compress_exit(void)
+{
+	dm_unregister_target(&compress_target);
+}
+
+/* Module hooks */
+module_init(dm_compress_init);
+module_exit(dm_compress_exit);
+
+MODULE_DESCRIPTION(DM_NAME " compressed read-only target");
+MODULE_LICENSE("GPL");
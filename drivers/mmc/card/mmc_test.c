@@ -1610,6 +1610,148 @@ static int mmc_test_profile_seq_trim_perf(struct mmc_test_card *test)
 	return 0;
 }
 
+/*
+ * Write @cnt chunks of @sz bytes, each followed by a gap of the same size,
+ * from the start of the test area as a single packed write command.
+ */
+static int mmc_test_packed_write(struct mmc_test_card *test, unsigned long sz,
+				 unsigned int cnt)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned int i, sg_len, blocks = sz >> 9;
+	struct mmc_request mrq;
+	struct mmc_command sbc;
+	struct mmc_command cmd;
+	struct mmc_data data;
+	struct scatterlist *sg;
+	__le32 *hdr;
+	int ret;
+
+	hdr = kzalloc(MMC_PACKED_HDR_SIZE, GFP_KERNEL);
+	sg = kmalloc(sizeof(struct scatterlist) * (t->max_segs + 1),
+		     GFP_KERNEL);
+	if (!hdr || !sg) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	hdr[0] = cpu_to_le32((cnt << 16) | (MMC_PACKED_WRITE << 8) |
+			     MMC_PACKED_VERSION);
+	for (i = 0; i < cnt; i++) {
+		u32 addr = t->dev_addr + i * 2 * blocks;
+
+		if (!mmc_card_blockaddr(test->card))
+			addr <<= 9;
+		hdr[(i + 1) * 2] = cpu_to_le32(blocks);
+		hdr[(i + 1) * 2 + 1] = cpu_to_le32(addr);
+	}
+
+	sg_init_table(sg, t->max_segs + 1);
+	sg_set_buf(&sg[0], hdr, MMC_PACKED_HDR_SIZE);
+	ret = mmc_test_map_sg(t->mem, sz * cnt, &sg[1], 1, t->max_segs,
+			      &sg_len);
+	if (ret)
+		goto out_free;
+
+	memset(&mrq, 0, sizeof(struct mmc_request));
+	memset(&sbc, 0, sizeof(struct mmc_command));
+	memset(&cmd, 0, sizeof(struct mmc_command));
+	memset(&data, 0, sizeof(struct mmc_data));
+
+	mrq.sbc = &sbc;
+	mrq.cmd = &cmd;
+	mrq.data = &data;
+
+	sbc.opcode = MMC_SET_BLOCK_COUNT;
+	sbc.arg = MMC_CMD23_ARG_PACKED | (cnt * blocks + 1);
+	sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	cmd.arg = t->dev_addr;
+	if (!mmc_card_blockaddr(test->card))
+		cmd.arg <<= 9;
+	cmd.flags = MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	data.blksz = 512;
+	data.blocks = cnt * blocks + 1;
+	data.flags = MMC_DATA_WRITE;
+	data.sg = sg;
+	data.sg_len = sg_len + 1;
+	mmc_set_data_timeout(&data, test->card);
+
+	mmc_wait_for_req(test->card->host, &mrq);
+
+	mmc_test_wait_busy(test);
+
+	ret = sbc.error;
+	if (!ret)
+		ret = mmc_test_check_result(test, &mrq);
+
+out_free:
+	kfree(sg);
+	kfree(hdr);
+	return ret;
+}
+
+/*
+ * Packed write performance by transfer size.  For each size the same
+ * scattered small writes are timed twice: first issued one by one, then
+ * as a single packed write.
+ */
+static int mmc_test_profile_packed_write_perf(struct mmc_test_card *test)
+{
+	struct mmc_card *card = test->card;
+	struct mmc_host *host = card->host;
+	unsigned long sz;
+	unsigned int dev_addr, i, cnt, max_cnt, max_blocks;
+	struct timespec ts1, ts2;
+	int ret;
+
+	if (card->ext_csd.max_packed_writes < 2)
+		return RESULT_UNSUP_CARD;
+
+	if (!(host->caps & MMC_CAP_PACKED_WR))
+		return RESULT_UNSUP_HOST;
+
+	max_cnt = min_t(unsigned int, card->ext_csd.max_packed_writes,
+			MMC_PACKED_MAX_ENTRIES);
+	max_blocks = min(host->max_blk_count, host->max_req_size >> 9);
+
+	for (sz = 512; sz <= 64 * 1024; sz <<= 1) {
+		/* Leave room for the header block and a gap per write */
+		cnt = min_t(unsigned long, max_cnt,
+			    (max_blocks - 1) / (sz >> 9));
+		cnt = min_t(unsigned long, cnt, test->area.max_sz / (2 * sz));
+		if (cnt < 2)
+			break;
+
+		ret = mmc_test_area_erase(test);
+		if (ret)
+			return ret;
+		dev_addr = test->area.dev_addr;
+		getnstimeofday(&ts1);
+		for (i = 0; i < cnt; i++) {
+			ret = mmc_test_area_io(test, sz, dev_addr, 1, 0, 0);
+			if (ret)
+				return ret;
+			dev_addr += 2 * (sz >> 9);
+		}
+		getnstimeofday(&ts2);
+		mmc_test_print_avg_rate(test, sz, cnt, &ts1, &ts2);
+
+		ret = mmc_test_area_erase(test);
+		if (ret)
+			return ret;
+		getnstimeofday(&ts1);
+		ret = mmc_test_packed_write(test, sz, cnt);
+		if (ret)
+			return ret;
+		getnstimeofday(&ts2);
+		mmc_test_print_avg_rate(test, sz, cnt, &ts1, &ts2);
+	}
+	return 0;
+}
+
 static const struct mmc_test_case mmc_test_cases[] = {
 	{
 		.name = "Basic write (no data verification)",
@@ -1849,6 +1991,13 @@ static const struct mmc_test_case mmc_test_cases[] = {
 		.cleanup = mmc_test_area_cleanup,
 	},
 
+	{
+		.name = "Packed write performance by transfer size",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_profile_packed_write_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
 };
 
 static DEFINE_MUTEX(mmc_test_lock);
@@ -150,11 +150,19 @@ void mmc_add_host_debugfs(struct mmc_host *host)
 	host->debugfs_root = root;
 
 	if (!debugfs_create_file("ios", S_IRUSR, root, host, &mmc_ios_fops))
-		goto err_ios;
+		goto err_node;
+
+	if (!debugfs_create_u64("bytes_direct", S_IRUSR, root,
+				&host->bytes_direct))
+		goto err_node;
+
+	if (!debugfs_create_u64("bytes_bounced", S_IRUSR, root,
+				&host->bytes_bounced))
+		goto err_node;
 
 	return;
 
-err_ios:
+err_node:
 	debugfs_remove_recursive(root);
 	host->debugfs_root = NULL;
 err_root:
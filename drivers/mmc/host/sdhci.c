@@ -406,6 +406,46 @@ static void sdhci_set_adma_desc(u8 *desc, u32 addr, int len, unsigned cmd)
 	dataddr[0] = cpu_to_le32(addr);
 }
 
+static inline int sdhci_dma_dir(struct mmc_data *data)
+{
+	return (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+}
+
+/*
+ * Map the sg list of @data for DMA.  With @next, this is done ahead of
+ * the request by sdhci_pre_req() and the mapping is tagged with a
+ * cookie; otherwise an earlier mapping is picked up if there is one.
+ */
+static int sdhci_pre_dma_transfer(struct sdhci_host *host,
+				  struct mmc_data *data,
+				  struct sdhci_next *next)
+{
+	int sg_count;
+
+	if (!next && data->host_cookie &&
+	    data->host_cookie == host->next_data.cookie) {
+		sg_count = host->next_data.sg_count;
+		host->next_data.sg_count = 0;
+	} else {
+		sg_count = dma_map_sg(mmc_dev(host->mmc), data->sg,
+				      data->sg_len, sdhci_dma_dir(data));
+	}
+
+	if (sg_count == 0)
+		return -EINVAL;
+
+	if (next) {
+		next->sg_count = sg_count;
+		if (++next->cookie < 0)
+			next->cookie = 1;
+		data->host_cookie = next->cookie;
+	} else {
+		host->sg_count = sg_count;
+	}
+
+	return sg_count;
+}
+
 static int sdhci_adma_table_pre(struct sdhci_host *host,
 	struct mmc_data *data)
 {
@@ -438,14 +478,12 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	 */
 
 	host->align_addr = dma_map_single(mmc_dev(host->mmc),
-		host->align_buffer, 128 * 4, direction);
+		host->align_buffer, SDHCI_MAX_SEGS * 4, direction);
 	if (dma_mapping_error(mmc_dev(host->mmc), host->align_addr))
 		goto fail;
 	BUG_ON(host->align_addr & 0x3);
 
-	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
-		data->sg, data->sg_len, direction);
-	if (host->sg_count == 0)
+	if (sdhci_pre_dma_transfer(host, data, NULL) < 0)
 		goto unmap_align;
 
 	desc = host->adma_desc;
@@ -476,7 +514,7 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 			/* tran, valid */
 			sdhci_set_adma_desc(desc, align_addr, offset, 0x21);
 
-			BUG_ON(offset > 65536);
+			host->align_bytes += offset;
 
 			align += 4;
 			align_addr += 4;
@@ -487,17 +525,26 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 			len -= offset;
 		}
 
-		BUG_ON(len > 65536);
+		/*
+		 * Segments may be longer than one descriptor can
+		 * describe, split them up.
+		 */
+		while (len) {
+			int chunk = min_t(int, len, host->adma_max_len);
 
-		/* tran, valid */
-		sdhci_set_adma_desc(desc, addr, len, 0x21);
-		desc += 8;
+			/* tran, valid */
+			sdhci_set_adma_desc(desc, addr, chunk, 0x21);
+			desc += 8;
+
+			addr += chunk;
+			len -= chunk;
+		}
 
 		/*
 		 * If this triggers then we have a calculation bug
 		 * somewhere. :/
 		 */
-		WARN_ON((desc - host->adma_desc) > (128 * 2 + 1) * 4);
+		WARN_ON((desc - host->adma_desc) >= host->adma_desc_len);
 	}
 
 	if (host->quirks & SDHCI_QUIRK_NO_ENDATTR_IN_NOPDESC) {
@@ -522,11 +569,11 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	 */
 	if (data->flags & MMC_DATA_WRITE) {
 		dma_sync_single_for_device(mmc_dev(host->mmc),
-			host->align_addr, 128 * 4, direction);
+			host->align_addr, SDHCI_MAX_SEGS * 4, direction);
 	}
 
 	host->adma_addr = dma_map_single(mmc_dev(host->mmc),
-		host->adma_desc, (128 * 2 + 1) * 4, DMA_TO_DEVICE);
+		host->adma_desc, host->adma_desc_len, DMA_TO_DEVICE);
 	if (dma_mapping_error(mmc_dev(host->mmc), host->adma_addr))
 		goto unmap_entries;
 	BUG_ON(host->adma_addr & 0x3);
@@ -534,11 +581,13 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	return 0;
 
 unmap_entries:
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	/* A premapped sg list is left to sdhci_post_req() */
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 unmap_align:
 	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
-		128 * 4, direction);
+		SDHCI_MAX_SEGS * 4, direction);
 fail:
 	return -EINVAL;
 }
@@ -560,10 +609,10 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		direction = DMA_TO_DEVICE;
 
 	dma_unmap_single(mmc_dev(host->mmc), host->adma_addr,
-		(128 * 2 + 1) * 4, DMA_TO_DEVICE);
+		host->adma_desc_len, DMA_TO_DEVICE);
 
 	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
-		128 * 4, direction);
+		SDHCI_MAX_SEGS * 4, direction);
 
 	if (data->flags & MMC_DATA_READ) {
 		dma_sync_sg_for_cpu(mmc_dev(host->mmc), data->sg,
@@ -585,8 +634,9 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 }
 
 static u8 sdhci_calc_timeout(struct sdhci_host *host, struct mmc_data *data)
@@ -649,6 +699,52 @@ static void sdhci_set_transfer_irqs(struct sdhci_host *host)
 		sdhci_clear_set_irqs(host, dma_irqs, pio_irqs);
 }
 
+/*
+ * Check the quirks that rule out DMA for a particular request.
+ */
+static bool sdhci_data_dma_ok(struct sdhci_host *host, struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	bool size_broken, addr_broken;
+	int i;
+
+	if (host->flags & SDHCI_USE_ADMA) {
+		size_broken = !!(host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE);
+		/*
+		 * As we use 3 byte chunks to work around
+		 * alignment problems, we need to check this
+		 * quirk for the alignment too.
+		 */
+		addr_broken = size_broken;
+	} else {
+		size_broken = !!(host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE);
+		addr_broken = !!(host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR);
+	}
+
+	if (likely(!size_broken && !addr_broken))
+		return true;
+
+	/*
+	 * FIXME: This doesn't account for merging when mapping the
+	 * scatterlist.  The assumption here being that alignment is
+	 * the same after translation to device address space.
+	 */
+	for_each_sg(data->sg, sg, data->sg_len, i) {
+		if (size_broken && (sg->length & 0x3)) {
+			DBG("Reverting to PIO because of "
+				"transfer size (%d)\n", sg->length);
+			return false;
+		}
+		if (addr_broken && (sg->offset & 0x3)) {
+			DBG("Reverting to PIO because of "
+				"bad alignment\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
 static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 {
 	u8 count;
@@ -671,72 +767,13 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 	count = sdhci_calc_timeout(host, data);
 	sdhci_writeb(host, count, SDHCI_TIMEOUT_CONTROL);
 
-	if (host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA))
-		host->flags |= SDHCI_REQ_USE_DMA;
+	host->align_bytes = 0;
 
-	/*
-	 * FIXME: This doesn't account for merging when mapping the
-	 * scatterlist.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
-
-		broken = 0;
-		if (host->flags & SDHCI_USE_ADMA) {
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
-		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->length & 0x3) {
-					DBG("Reverting to PIO because of "
-						"transfer size (%d)\n",
-						sg->length);
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
-		}
-	}
-
-	/*
-	 * The assumption here being that alignment is the same after
-	 * translation to device address space.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
-
-		broken = 0;
-		if (host->flags & SDHCI_USE_ADMA) {
-			/*
-			 * As we use 3 byte chunks to work around
-			 * alignment problems, we need to check this
-			 * quirk.
-			 */
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
-		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->offset & 0x3) {
-					DBG("Reverting to PIO because of "
-						"bad alignment\n");
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
-		}
-	}
+	if ((host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA)) &&
+	    sdhci_data_dma_ok(host, data))
+		host->flags |= SDHCI_REQ_USE_DMA;
+	else
+		host->flags &= ~SDHCI_REQ_USE_DMA;
 
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA) {
@@ -755,12 +792,8 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 		} else {
 			int sg_cnt;
 
-			sg_cnt = dma_map_sg(mmc_dev(host->mmc),
-					data->sg, data->sg_len,
-					(data->flags & MMC_DATA_READ) ?
-						DMA_FROM_DEVICE :
-						DMA_TO_DEVICE);
-			if (sg_cnt == 0) {
+			sg_cnt = sdhci_pre_dma_transfer(host, data, NULL);
+			if (sg_cnt <= 0) {
 				/*
 				 * This only happens when someone fed
 				 * us an invalid request.
@@ -794,6 +827,13 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_data *data)
 	if (!(host->flags & SDHCI_REQ_USE_DMA)) {
 		int flags;
 
+		/* The CPU is going to touch the pages, drop any mapping */
+		if (data->host_cookie) {
+			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+				data->sg_len, sdhci_dma_dir(data));
+			data->host_cookie = 0;
+		}
+
 		flags = SG_MITER_ATOMIC;
 		if (host->data->flags & MMC_DATA_READ)
 			flags |= SG_MITER_TO_SG;
@@ -847,7 +887,7 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA)
 			sdhci_adma_table_post(host, data);
-		else {
+		else if (!data->host_cookie) {
 			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 				data->sg_len, (data->flags & MMC_DATA_READ) ?
 					DMA_FROM_DEVICE : DMA_TO_DEVICE);
@@ -866,6 +906,19 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	else
 		data->bytes_xfered = data->blksz * data->blocks;
 
+	/*
+	 * Bytes that went through the MMC queue bounce buffer, PIO or
+	 * the ADMA alignment buffer were copied by the CPU.
+	 */
+	if ((data->flags & MMC_DATA_BOUNCED) ||
+	    !(host->flags & SDHCI_REQ_USE_DMA)) {
+		host->mmc->bytes_bounced += data->bytes_xfered;
+	} else if (data->bytes_xfered) {
+		host->mmc->bytes_bounced += host->align_bytes;
+		host->mmc->bytes_direct += data->bytes_xfered -
+					   host->align_bytes;
+	}
+
 	if (data->stop) {
 		/*
 		 * The controller needs a reset of internal state machines
@@ -1304,7 +1357,42 @@ int sdhci_disable(struct mmc_host *mmc, int lazy)
 	return 0;
 }
 
+/*
+ * Map the data of the next request while the current one is still
+ * running, so that the cache maintenance is off the critical path.
+ */
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	data->host_cookie = 0;
+
+	if ((host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA)) &&
+	    sdhci_data_dma_ok(host, data))
+		sdhci_pre_dma_transfer(host, data, &host->next_data);
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			   int err)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (data && data->host_cookie) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     sdhci_dma_dir(data));
+		data->host_cookie = 0;
+	}
+}
+
 static const struct mmc_host_ops sdhci_ops = {
+	.pre_req	= sdhci_pre_req,
+	.post_req	= sdhci_post_req,
 	.request	= sdhci_request,
 	.set_ios	= sdhci_set_ios,
 	.get_ro		= sdhci_get_ro,
@@ -1834,14 +1922,34 @@ int sdhci_add_host(struct sdhci_host *host)
 		}
 	}
 
+	/*
+	 * Maximum number of sectors in one transfer. Limited by DMA boundary
+	 * size (512KiB). Set before the ADMA table is sized from it.
+	 */
+	mmc->max_req_size = 524288;
+
 	if (host->flags & SDHCI_USE_ADMA) {
+		/*
+		 * A descriptor can move at most 64 KiB, or a little
+		 * less if zero length (meaning 64 KiB) descriptors are
+		 * broken.  Keep split descriptors 32-bit aligned.
+		 */
+		if (host->quirks & SDHCI_QUIRK_BROKEN_ADMA_ZEROLEN_DESC)
+			host->adma_max_len = 65536 - 4;
+		else
+			host->adma_max_len = 65536;
+
 		/*
 		 * We need to allocate descriptors for all sg entries
-		 * (128) and potentially one alignment transfer for
-		 * each of those entries.
+		 * (SDHCI_MAX_SEGS), potentially one alignment transfer
+		 * for each of those entries, one more for each split of
+		 * a long entry, and the terminating entry.
 		 */
-		host->adma_desc = kmalloc((128 * 2 + 1) * 4, GFP_KERNEL);
-		host->align_buffer = kmalloc(128 * 4, GFP_KERNEL);
+		host->adma_desc_len = (SDHCI_MAX_SEGS * 2 +
+			DIV_ROUND_UP(mmc->max_req_size,
+				     host->adma_max_len) + 1) * 8;
+		host->adma_desc = kmalloc(host->adma_desc_len, GFP_KERNEL);
+		host->align_buffer = kmalloc(SDHCI_MAX_SEGS * 4, GFP_KERNEL);
 		if (!host->adma_desc || !host->align_buffer) {
 			kfree(host->adma_desc);
 			kfree(host->align_buffer);
@@ -1931,6 +2039,10 @@ int sdhci_add_host(struct sdhci_host *host)
 	if (host->quirks & SDHCI_QUIRK_RUNTIME_DISABLE)
 		mmc->caps |= MMC_CAP_DISABLE;
 
+	/* Packed writes send header and data as one scatter/gather list */
+	if (host->flags & SDHCI_USE_ADMA)
+		mmc->caps |= MMC_CAP_PACKED_WR;
+
 	mmc->ocr_avail = 0;
 	if (caps & SDHCI_CAN_VDD_330)
 		mmc->ocr_avail |= MMC_VDD_32_33|MMC_VDD_33_34;
@@ -1952,32 +2064,19 @@ int sdhci_add_host(struct sdhci_host *host)
 	 * can do scatter/gather or not.
 	 */
 	if (host->flags & SDHCI_USE_ADMA)
-		mmc->max_hw_segs = 128;
+		mmc->max_hw_segs = SDHCI_MAX_SEGS;
 	else if (host->flags & SDHCI_USE_SDMA)
 		mmc->max_hw_segs = 1;
 	else /* PIO */
-		mmc->max_hw_segs = 128;
-	mmc->max_phys_segs = 128;
-
-	/*
-	 * Maximum number of sectors in one transfer. Limited by DMA boundary
-	 * size (512KiB).
-	 */
-	mmc->max_req_size = 524288;
+		mmc->max_hw_segs = SDHCI_MAX_SEGS;
+	mmc->max_phys_segs = SDHCI_MAX_SEGS;
 
 	/*
 	 * Maximum segment size. Could be one segment with the maximum number
-	 * of bytes. When doing hardware scatter/gather, each entry cannot
-	 * be larger than 64 KiB though.
+	 * of bytes. When doing hardware scatter/gather, entries larger than
+	 * one descriptor can take are split by sdhci_adma_table_pre().
 	 */
-	if (host->flags & SDHCI_USE_ADMA) {
-		if (host->quirks & SDHCI_QUIRK_BROKEN_ADMA_ZEROLEN_DESC)
-			mmc->max_seg_size = 0xffff;
-		else
-			mmc->max_seg_size = 65536;
-	} else {
-		mmc->max_seg_size = mmc->max_req_size;
-	}
+	mmc->max_seg_size = mmc->max_req_size;
 
 	/*
 	 * Maximum block size. This varies from controller to controller and
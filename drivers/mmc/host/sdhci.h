@@ -182,6 +182,15 @@
 
 struct sdhci_ops;
 
+/* Scatter-gather entries per request, for ADMA and PIO alike */
+#define SDHCI_MAX_SEGS		128
+
+/* DMA mapping done ahead of a request by sdhci_pre_req() */
+struct sdhci_next {
+	unsigned int	sg_count;
+	s32		cookie;
+};
+
 struct sdhci_host {
 	/* Data set by hardware interface driver */
 	const char		*hw_name;	/* Hardware bus name */
@@ -308,10 +317,15 @@ struct sdhci_host {
 	unsigned int		blocks;		/* remaining PIO blocks */
 
 	int			sg_count;	/* Mapped sg entries */
+	unsigned int		align_bytes;	/* Bytes sent via align buffer */
+	struct sdhci_next	next_data;	/* Premapped next request */
 
 	u8			*adma_desc;	/* ADMA descriptor table */
 	u8			*align_buffer;	/* Bounce buffer */
 
+	unsigned int		adma_desc_len;	/* Size of ADMA descr. table */
+	unsigned int		adma_max_len;	/* Max bytes per ADMA descr. */
+
 	dma_addr_t		adma_addr;	/* Mapped ADMA descr. table */
 	dma_addr_t		align_addr;	/* Mapped bounce buffer */
 
@@ -437,22 +437,26 @@ static unsigned long long au_iarray_cb(void *a,
 {
 	unsigned long long n;
 	struct inode **p, *inode;
-	struct list_head *head;
+	struct super_block *sb;
 
 	n = 0;
 	p = a;
-	head = arg;
-	spin_lock(&inode_lock);
-	list_for_each_entry(inode, head, i_sb_list) {
-		if (!is_bad_inode(inode)
+	sb = arg;
+	spin_lock(&sb->s_inode_list_lock);
+	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
+		/* inodes stay on the list until evict() is done with them */
+		spin_lock(&inode->i_lock);
+		if (!(inode->i_state & (I_FREEING | I_WILL_FREE | I_NEW))
+		    && !is_bad_inode(inode)
 		    && au_ii(inode)->ii_bstart >= 0) {
-			au_igrab(inode);
+			__iget(inode);
 			*p++ = inode;
 			n++;
 			AuDebugOn(n > max);
 		}
+		spin_unlock(&inode->i_lock);
 	}
-	spin_unlock(&inode_lock);
+	spin_unlock(&sb->s_inode_list_lock);
 
 	return n;
 }
@@ -460,7 +464,7 @@ static unsigned long long au_iarray_cb(void *a,
 struct inode **au_iarray_alloc(struct super_block *sb, unsigned long long *max)
 {
 	*max = atomic_long_read(&au_sbi(sb)->si_ninodes);
-	return au_array_alloc(max, au_iarray_cb, &sb->s_inodes);
+	return au_array_alloc(max, au_iarray_cb, sb);
 }
 
 void au_iarray_free(struct inode **a, unsigned long long max)
@@ -76,11 +76,11 @@ static void sysrq_sb(struct super_block *sb)
 	{
 		struct inode *i;
 		printk(KERN_WARNING AUFS_NAME ": isolated inode\n");
-		spin_lock(&inode_lock);
+		spin_lock(&sb->s_inode_list_lock);
 		list_for_each_entry(i, &sb->s_inodes, i_sb_list)
 			if (1 || list_empty(&i->i_dentry))
 				au_dpri_inode(i);
-		spin_unlock(&inode_lock);
+		spin_unlock(&sb->s_inode_list_lock);
 	}
 #endif
 	printk(KERN_WARNING AUFS_NAME ": files\n");
@@ -106,6 +106,8 @@ static void dentry_iput(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	if (inode) {
+		/* RCU walkers must not follow us to an inode on its way out */
+		write_seqcount_barrier(&dentry->d_seq);
 		dentry->d_inode = NULL;
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
@@ -951,6 +953,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -1443,6 +1446,85 @@ next:
  	return found;
 }
 
+/*
+ * __d_lookup_rcu - search for a dentry without locking or refcounting
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seq: returns the d_seq value of the dentry found
+ * Returns: dentry, or NULL
+ *
+ * The caller must hold rcu_read_lock().  Neither d_lock nor a reference
+ * is taken on the result, so it may be renamed, unhashed or turned
+ * negative at any time: it may only be trusted for as long as
+ * read_seqcount_retry(&dentry->d_seq, *seq) says it has not changed.
+ * Use d_rcu_to_refcount() to turn it into a real reference.
+ *
+ * Like __d_lookup this may return a false negative under concurrent
+ * renames.  Parents with a ->d_compare method are not handled here.
+ */
+struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
+			      unsigned *seq)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent, hash);
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+		const unsigned char *tname;
+		unsigned int tlen;
+		unsigned s;
+
+		if (dentry->d_name.hash != hash)
+			continue;
+seqretry:
+		s = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		tlen = dentry->d_name.len;
+		tname = dentry->d_name.name;
+		if (read_seqcount_retry(&dentry->d_seq, s)) {
+			cpu_relax();
+			goto seqretry;
+		}
+		/*
+		 * The name may still change under us, but then so does d_seq
+		 * and the caller will catch it when it validates the result.
+		 */
+		if (tlen != len || memcmp(tname, str, len))
+			continue;
+		*seq = s;
+		return dentry;
+	}
+	return NULL;
+}
+
+/*
+ * d_rcu_to_refcount - take a reference on a dentry found by an RCU walk
+ * @dentry: dentry returned by __d_lookup_rcu
+ * @seq: d_seq value returned with it
+ *
+ * Returns 1 with a reference held if @dentry is still hashed and has not
+ * changed since @seq was sampled, 0 otherwise.  Must be called under the
+ * same rcu_read_lock() section that found @dentry.
+ */
+int d_rcu_to_refcount(struct dentry *dentry, unsigned seq)
+{
+	int ret = 0;
+
+	spin_lock(&dentry->d_lock);
+	if (!d_unhashed(dentry) && !read_seqcount_retry(&dentry->d_seq, seq)) {
+		atomic_inc(&dentry->d_count);
+		ret = 1;
+	}
+	spin_unlock(&dentry->d_lock);
+	return ret;
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -1676,6 +1758,9 @@ static void d_move_locked(struct dentry * dentry, struct dentry * target)
 		spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED);
 	}
 
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
+
 	/* Move the dentry to the target hash queue, if on different bucket */
 	if (d_unhashed(dentry))
 		goto already_unhashed;
@@ -1709,6 +1794,8 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_u.d_child, &dentry->d_parent->d_subdirs);
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
 	spin_unlock(&target->d_lock);
 	fsnotify_d_move(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -1803,6 +1890,9 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 {
 	struct dentry *dparent, *aparent;
 
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&anon->d_seq);
+
 	switch_names(dentry, anon);
 	swap(dentry->d_name.hash, anon->d_name.hash);
 
@@ -1823,6 +1913,9 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 	else
 		INIT_LIST_HEAD(&anon->d_u.d_child);
 
+	write_seqcount_end(&anon->d_seq);
+	write_seqcount_end(&dentry->d_seq);
+
 	anon->d_flags &= ~DCACHE_DISCONNECTED;
 }
 
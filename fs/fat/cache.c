@@ -13,10 +13,19 @@
 #include <linux/buffer_head.h>
 #include "fat.h"
 
-/* this must be > 0. */
-#define FAT_MAX_CACHE	8
+/*
+ * Each inode caches the runs of contiguous clusters of its chain found
+ * while walking it, in an rbtree indexed by file cluster.  Runs next to
+ * each other on disk are merged, so a lookup is O(log extents) and the
+ * FAT is only read from the end of the nearest run before the cluster.
+ * Once the cache is full, a new run replaces the least recently used.
+ */
+
+/* Max number of extents cached per inode, this must be > 0. */
+#define FAT_MAX_CACHE	512
 
 struct fat_cache {
+	struct rb_node rb_node;
 	struct list_head cache_list;
 	int nr_contig;	/* number of contiguous clusters */
 	int fcluster;	/* cluster number in the file. */
@@ -30,26 +39,14 @@ struct fat_cache_id {
 	int dcluster;
 };
 
-static inline int fat_max_cache(struct inode *inode)
-{
-	return FAT_MAX_CACHE;
-}
-
 static struct kmem_cache *fat_cache_cachep;
 
-static void init_once(void *foo)
-{
-	struct fat_cache *cache = (struct fat_cache *)foo;
-
-	INIT_LIST_HEAD(&cache->cache_list);
-}
-
 int __init fat_cache_init(void)
 {
 	fat_cache_cachep = kmem_cache_create("fat_cache",
 				sizeof(struct fat_cache),
 				0, SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD,
-				init_once);
+				NULL);
 	if (fat_cache_cachep == NULL)
 		return -ENOMEM;
 	return 0;
@@ -67,41 +64,43 @@ static inline struct fat_cache *fat_cache_alloc(struct inode *inode)
 
 static inline void fat_cache_free(struct fat_cache *cache)
 {
-	BUG_ON(!list_empty(&cache->cache_list));
 	kmem_cache_free(fat_cache_cachep, cache);
 }
 
-static inline void fat_cache_update_lru(struct inode *inode,
-					struct fat_cache *cache)
+/* The extent starting at or nearest before fclus, or NULL */
+static struct fat_cache *fat_cache_floor(struct inode *inode, int fclus)
 {
-	if (MSDOS_I(inode)->cache_lru.next != &cache->cache_list)
-		list_move(&cache->cache_list, &MSDOS_I(inode)->cache_lru);
+	struct rb_node *n = MSDOS_I(inode)->cache_tree.rb_node;
+	struct fat_cache *hit = NULL;
+
+	while (n) {
+		struct fat_cache *p = rb_entry(n, struct fat_cache, rb_node);
+
+		if (p->fcluster <= fclus) {
+			hit = p;
+			n = n->rb_right;
+		} else
+			n = n->rb_left;
+	}
+	return hit;
 }
 
 static int fat_cache_lookup(struct inode *inode, int fclus,
 			    struct fat_cache_id *cid,
 			    int *cached_fclus, int *cached_dclus)
 {
-	static struct fat_cache nohit = { .fcluster = 0, };
-
-	struct fat_cache *hit = &nohit, *p;
+	struct fat_cache *hit;
 	int offset = -1;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
+	spin_lock(&MSDOS_I(inode)->cache_lock);
+	hit = fat_cache_floor(inode, fclus);
+	if (hit) {
+		list_move(&hit->cache_list, &MSDOS_I(inode)->cache_lru);
 		/* Find the cache of "fclus" or nearest cache. */
-		if (p->fcluster <= fclus && hit->fcluster < p->fcluster) {
-			hit = p;
-			if ((hit->fcluster + hit->nr_contig) < fclus) {
-				offset = hit->nr_contig;
-			} else {
-				offset = fclus - hit->fcluster;
-				break;
-			}
-		}
-	}
-	if (hit != &nohit) {
-		fat_cache_update_lru(inode, hit);
+		if ((hit->fcluster + hit->nr_contig) < fclus)
+			offset = hit->nr_contig;
+		else
+			offset = fclus - hit->fcluster;
 
 		cid->id = MSDOS_I(inode)->cache_valid_id;
 		cid->nr_contig = hit->nr_contig;
@@ -110,81 +109,119 @@ static int fat_cache_lookup(struct inode *inode, int fclus,
 		*cached_fclus = cid->fcluster + offset;
 		*cached_dclus = cid->dcluster + offset;
 	}
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&MSDOS_I(inode)->cache_lock);
 
 	return offset;
 }
 
-static struct fat_cache *fat_cache_merge(struct inode *inode,
-					 struct fat_cache_id *new)
+/* Does the run starting at fclus/dclus overlap or continue "p" on disk? */
+static inline int fat_cache_mergeable(struct fat_cache *p, int fclus,
+				      int dclus)
 {
-	struct fat_cache *p;
-
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
-		/* Find the same part as "new" in cluster-chain. */
-		if (p->fcluster == new->fcluster) {
-			BUG_ON(p->dcluster != new->dcluster);
-			if (new->nr_contig > p->nr_contig)
-				p->nr_contig = new->nr_contig;
-			return p;
-		}
+	return p->fcluster + p->nr_contig + 1 >= fclus &&
+		p->dcluster + (fclus - p->fcluster) == dclus;
+}
+
+static void fat_cache_insert(struct inode *inode, struct fat_cache *cache)
+{
+	struct rb_node **p = &MSDOS_I(inode)->cache_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (cache->fcluster < rb_entry(parent, struct fat_cache,
+					       rb_node)->fcluster)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
 	}
-	return NULL;
+	rb_link_node(&cache->rb_node, parent, p);
+	rb_insert_color(&cache->rb_node, &MSDOS_I(inode)->cache_tree);
 }
 
 static void fat_cache_add(struct inode *inode, struct fat_cache_id *new)
 {
-	struct fat_cache *cache, *tmp;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	struct fat_cache *cache, *next, *tmp = NULL;
+	struct rb_node *n;
+	int end;
 
 	if (new->fcluster == -1) /* dummy cache */
 		return;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	if (new->id != FAT_CACHE_VALID &&
-	    new->id != MSDOS_I(inode)->cache_valid_id)
+	spin_lock(&i->cache_lock);
+again:
+	if (new->id != FAT_CACHE_VALID && new->id != i->cache_valid_id)
 		goto out;	/* this cache was invalidated */
 
-	cache = fat_cache_merge(inode, new);
-	if (cache == NULL) {
-		if (MSDOS_I(inode)->nr_caches < fat_max_cache(inode)) {
-			MSDOS_I(inode)->nr_caches++;
-			spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
-
+	cache = fat_cache_floor(inode, new->fcluster);
+	if (cache && fat_cache_mergeable(cache, new->fcluster, new->dcluster)) {
+		end = max(cache->fcluster + cache->nr_contig,
+			  new->fcluster + new->nr_contig);
+		cache->nr_contig = end - cache->fcluster;
+		list_move(&cache->cache_list, &i->cache_lru);
+	} else {
+		if (cache && cache->fcluster == new->fcluster)
+			goto out;
+		if (i->nr_caches >= FAT_MAX_CACHE) {
+			/* Reuse the least recently used extent */
+			cache = list_entry(i->cache_lru.prev,
+					   struct fat_cache, cache_list);
+			rb_erase(&cache->rb_node, &i->cache_tree);
+			list_del(&cache->cache_list);
+			i->nr_caches--;
+		} else if (!tmp) {
+			spin_unlock(&i->cache_lock);
 			tmp = fat_cache_alloc(inode);
-			spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-			cache = fat_cache_merge(inode, new);
-			if (cache != NULL) {
-				MSDOS_I(inode)->nr_caches--;
-				fat_cache_free(tmp);
-				goto out_update_lru;
-			}
-			cache = tmp;
+			spin_lock(&i->cache_lock);
+			if (!tmp)
+				goto out;
+			goto again;
 		} else {
-			struct list_head *p = MSDOS_I(inode)->cache_lru.prev;
-			cache = list_entry(p, struct fat_cache, cache_list);
+			cache = tmp;
+			tmp = NULL;
 		}
 		cache->fcluster = new->fcluster;
 		cache->dcluster = new->dcluster;
 		cache->nr_contig = new->nr_contig;
+		fat_cache_insert(inode, cache);
+		list_add(&cache->cache_list, &i->cache_lru);
+		i->nr_caches++;
+	}
+
+	/* Swallow the following runs that this one now reaches */
+	while ((n = rb_next(&cache->rb_node)) != NULL) {
+		next = rb_entry(n, struct fat_cache, rb_node);
+		if (!fat_cache_mergeable(cache, next->fcluster, next->dcluster))
+			break;
+		end = max(cache->fcluster + cache->nr_contig,
+			  next->fcluster + next->nr_contig);
+		cache->nr_contig = end - cache->fcluster;
+		rb_erase(n, &i->cache_tree);
+		list_del(&next->cache_list);
+		i->nr_caches--;
+		fat_cache_free(next);
 	}
-out_update_lru:
-	fat_cache_update_lru(inode, cache);
 out:
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
+	if (tmp)
+		fat_cache_free(tmp);
 }
 
 /*
- * Cache invalidation occurs rarely, thus the LRU chain is not updated. It
- * fixes itself after a while.
+ * Cache invalidation occurs rarely (truncate, or the chain being
+ * extended), so all of the extents are simply dropped.
  */
 static void __fat_cache_inval_inode(struct inode *inode)
 {
 	struct msdos_inode_info *i = MSDOS_I(inode);
-	struct fat_cache *cache;
+	struct rb_node *n;
 
-	while (!list_empty(&i->cache_lru)) {
-		cache = list_entry(i->cache_lru.next, struct fat_cache, cache_list);
-		list_del_init(&cache->cache_list);
+	while ((n = rb_first(&i->cache_tree)) != NULL) {
+		struct fat_cache *cache = rb_entry(n, struct fat_cache, rb_node);
+
+		rb_erase(n, &i->cache_tree);
+		list_del(&cache->cache_list);
 		i->nr_caches--;
 		fat_cache_free(cache);
 	}
@@ -196,9 +233,25 @@ static void __fat_cache_inval_inode(struct inode *inode)
 
 void fat_cache_inval_inode(struct inode *inode)
 {
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_lock(&MSDOS_I(inode)->cache_lock);
 	__fat_cache_inval_inode(inode);
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&MSDOS_I(inode)->cache_lock);
+}
+
+/*
+ * Record a cluster just linked to the end of the chain.  Appending
+ * leaves the cached extents valid, and this one usually just grows
+ * the last of them.  Caller must hold ->i_mutex.
+ */
+void fat_cache_add_tail(struct inode *inode, int fclus, int dclus)
+{
+	struct fat_cache_id cid;
+
+	cid.id = FAT_CACHE_VALID;
+	cid.fcluster = fclus;
+	cid.dcluster = dclus;
+	cid.nr_contig = 0;
+	fat_cache_add(inode, &cid);
 }
 
 static inline int cache_contiguous(struct fat_cache_id *cid, int dclus)
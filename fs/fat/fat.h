@@ -6,7 +6,9 @@
 #include <linux/nls.h>
 #include <linux/fs.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <linux/ratelimit.h>
+#include <linux/rbtree.h>
 #include <linux/msdos_fs.h>
 
 /*
@@ -72,6 +74,8 @@ struct msdos_sb_info {
 	unsigned int prev_free;      /* previously allocated cluster number */
 	unsigned int free_clusters;  /* -1 if undefined */
 	unsigned int free_clus_valid; /* is free_clusters valid? */
+	unsigned long *free_bitmap;  /* bit set for each free cluster */
+	struct work_struct free_bitmap_work; /* builds free_bitmap at mount */
 	struct fat_mount_options options;
 	struct nls_table *nls_disk;  /* Codepage used on disk */
 	struct nls_table *nls_io;    /* Charset used for input and display */
@@ -96,8 +100,9 @@ struct msdos_sb_info {
  * MS-DOS file system inode data in memory
  */
 struct msdos_inode_info {
-	spinlock_t cache_lru_lock;
-	struct list_head cache_lru;
+	spinlock_t cache_lock;
+	struct rb_root cache_tree;	/* extents of the cluster chain */
+	struct list_head cache_lru;	/* the same extents, most recent first */
 	int nr_caches;
 	/* for avoiding the race between fat_free() and fat_get_cluster() */
 	unsigned int cache_valid_id;
@@ -232,6 +237,7 @@ static inline void fatwchar_to16(__u8 *dst, const wchar_t *src, size_t len)
 
 /* fat/cache.c */
 extern void fat_cache_inval_inode(struct inode *inode);
+extern void fat_cache_add_tail(struct inode *inode, int fclus, int dclus);
 extern int fat_get_cluster(struct inode *inode, int cluster,
 			   int *fclus, int *dclus);
 extern int fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
@@ -300,6 +306,8 @@ extern int fat_alloc_clusters(struct inode *inode, int *cluster,
 			      int nr_cluster);
 extern int fat_free_clusters(struct inode *inode, int cluster);
 extern int fat_count_free_clusters(struct super_block *sb);
+extern void fat_free_bitmap_start(struct super_block *sb);
+extern void fat_free_bitmap_release(struct super_block *sb);
 
 /* fat/file.c */
 extern long fat_generic_ioctl(struct file *filp, unsigned int cmd,
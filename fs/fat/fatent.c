@@ -7,6 +7,7 @@
 #include <linux/fs.h>
 #include <linux/msdos_fs.h>
 #include <linux/blkdev.h>
+#include <linux/vmalloc.h>
 #include "fat.h"
 
 struct fatent_operations {
@@ -286,11 +287,14 @@ static inline void unlock_fat(struct msdos_sb_info *sbi)
 	mutex_unlock(&sbi->fat_lock);
 }
 
+static void fat_free_bitmap_work(struct work_struct *work);
+
 void fat_ent_access_init(struct super_block *sb)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 
 	mutex_init(&sbi->fat_lock);
+	INIT_WORK(&sbi->free_bitmap_work, fat_free_bitmap_work);
 
 	switch (sbi->fat_bits) {
 	case 32:
@@ -452,6 +456,47 @@ static void fat_collect_bhs(struct buffer_head **bhs, int *nr_bhs,
 	}
 }
 
+static int fat_free_bitmap_build(struct super_block *sb);
+
+/*
+ * Next free cluster at or after entry according to the free bitmap,
+ * wrapping around to the start of the FAT.  -1 if there is none.
+ */
+static int fat_find_free(struct msdos_sb_info *sbi, int entry)
+{
+	unsigned long next;
+
+	next = find_next_bit(sbi->free_bitmap, sbi->max_cluster, entry);
+	if (next >= sbi->max_cluster)
+		next = find_next_bit(sbi->free_bitmap, sbi->max_cluster,
+				     FAT_START_ENT);
+	return next < sbi->max_cluster ? next : -1;
+}
+
+/* Take the free entry at fatent, linking it after prev_ent if any */
+static void fat_alloc_take(struct super_block *sb, struct fat_entry *fatent,
+			   struct fat_entry *prev_ent,
+			   struct buffer_head **bhs, int *nr_bhs)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct fatent_operations *ops = sbi->fatent_ops;
+	int entry = fatent->entry;
+
+	/* make the cluster chain */
+	ops->ent_put(fatent, FAT_ENT_EOF);
+	if (prev_ent->nr_bhs)
+		ops->ent_put(prev_ent, entry);
+
+	fat_collect_bhs(bhs, nr_bhs, fatent);
+
+	sbi->prev_free = entry;
+	if (sbi->free_clusters != -1)
+		sbi->free_clusters--;
+	if (sbi->free_bitmap)
+		__clear_bit(entry, sbi->free_bitmap);
+	sb->s_dirt = 1;
+}
+
 int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -464,6 +509,10 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	BUG_ON(nr_cluster > (MAX_BUF_PER_PAGE / 2));	/* fixed limit */
 
 	lock_fat(sbi);
+	/* Failing this, fall back to scanning the FAT below */
+	if (!sbi->free_bitmap)
+		fat_free_bitmap_build(sb);
+
 	if (sbi->free_clusters != -1 && sbi->free_clus_valid &&
 	    sbi->free_clusters < nr_cluster) {
 		unlock_fat(sbi);
@@ -471,9 +520,37 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	}
 
 	err = nr_bhs = idx_clus = 0;
-	count = FAT_START_ENT;
 	fatent_init(&prev_ent);
 	fatent_init(&fatent);
+
+	if (sbi->free_bitmap) {
+		int entry = sbi->prev_free + 1;
+
+		while ((entry = fat_find_free(sbi, entry)) >= 0) {
+			err = fat_ent_read(inode, &fatent, entry);
+			if (err < 0)
+				goto out;
+			if (err != FAT_ENT_FREE) {
+				/* stale bit, just drop it */
+				__clear_bit(entry, sbi->free_bitmap);
+				continue;
+			}
+			err = 0;
+
+			fat_alloc_take(sb, &fatent, &prev_ent, bhs, &nr_bhs);
+			cluster[idx_clus] = entry;
+			idx_clus++;
+			if (idx_clus == nr_cluster)
+				goto out;
+
+			/* fat_collect_bhs() got the bhs, prev_ent stays valid */
+			prev_ent = fatent;
+			entry++;
+		}
+		goto nospc;
+	}
+
+	count = FAT_START_ENT;
 	fatent_set_entry(&fatent, sbi->prev_free + 1);
 	while (count < sbi->max_cluster) {
 		if (fatent.entry >= sbi->max_cluster)
@@ -488,17 +565,8 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 			if (ops->ent_get(&fatent) == FAT_ENT_FREE) {
 				int entry = fatent.entry;
 
-				/* make the cluster chain */
-				ops->ent_put(&fatent, FAT_ENT_EOF);
-				if (prev_ent.nr_bhs)
-					ops->ent_put(&prev_ent, entry);
-
-				fat_collect_bhs(bhs, &nr_bhs, &fatent);
-
-				sbi->prev_free = entry;
-				if (sbi->free_clusters != -1)
-					sbi->free_clusters--;
-				sb->s_dirt = 1;
+				fat_alloc_take(sb, &fatent, &prev_ent, bhs,
+					       &nr_bhs);
 
 				cluster[idx_clus] = entry;
 				idx_clus++;
@@ -517,6 +585,7 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 		} while (fat_ent_next(sbi, &fatent));
 	}
 
+nospc:
 	/* Couldn't allocate the free entries */
 	sbi->free_clusters = 0;
 	sbi->free_clus_valid = 1;
@@ -588,6 +657,8 @@ int fat_free_clusters(struct inode *inode, int cluster)
 			sbi->free_clusters++;
 			sb->s_dirt = 1;
 		}
+		if (sbi->free_bitmap)
+			__set_bit(fatent.entry, sbi->free_bitmap);
 
 		if (nr_bhs + fatent.nr_bhs > MAX_BUF_PER_PAGE) {
 			if (sb->s_flags & MS_SYNCHRONOUS) {
@@ -638,7 +709,12 @@ static void fat_ent_reada(struct super_block *sb, struct fat_entry *fatent,
 		sb_breadahead(sb, blocknr + i);
 }
 
-int fat_count_free_clusters(struct super_block *sb)
+/*
+ * Count the free entries of the whole FAT, setting their bits in bitmap
+ * if one is given.  Called with lock_fat() held.
+ */
+static int fat_scan_free_clusters(struct super_block *sb,
+				  unsigned long *bitmap)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct fatent_operations *ops = sbi->fatent_ops;
@@ -646,10 +722,6 @@ int fat_count_free_clusters(struct super_block *sb)
 	unsigned long reada_blocks, reada_mask, cur_block;
 	int err = 0, free;
 
-	lock_fat(sbi);
-	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
-		goto out;
-
 	reada_blocks = FAT_READA_SIZE >> sb->s_blocksize_bits;
 	reada_mask = reada_blocks - 1;
 	cur_block = 0;
@@ -670,15 +742,87 @@ int fat_count_free_clusters(struct super_block *sb)
 			goto out;
 
 		do {
-			if (ops->ent_get(&fatent) == FAT_ENT_FREE)
+			if (ops->ent_get(&fatent) == FAT_ENT_FREE) {
 				free++;
+				if (bitmap)
+					__set_bit(fatent.entry, bitmap);
+			}
 		} while (fat_ent_next(sbi, &fatent));
 	}
 	sbi->free_clusters = free;
 	sbi->free_clus_valid = 1;
 	sb->s_dirt = 1;
-	fatent_brelse(&fatent);
 out:
+	fatent_brelse(&fatent);
+	return err;
+}
+
+/*
+ * Build the in-memory bitmap of free clusters, which is then kept up
+ * to date by fat_alloc_clusters() and fat_free_clusters().  With it,
+ * allocation goes straight to the next free cluster instead of reading
+ * FAT blocks until it finds one, and the free count is always valid.
+ * Read-only mounts only get the count.  Called with lock_fat() held.
+ */
+static int fat_free_bitmap_build(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	unsigned long *bitmap;
+	int err;
+
+	if (!sbi->free_bitmap && !(sb->s_flags & MS_RDONLY)) {
+		size_t size = BITS_TO_LONGS(sbi->max_cluster) * sizeof(long);
+
+		bitmap = vmalloc(size);
+		if (bitmap) {
+			memset(bitmap, 0, size);
+			err = fat_scan_free_clusters(sb, bitmap);
+			if (err)
+				vfree(bitmap);
+			else
+				sbi->free_bitmap = bitmap;
+			return err;
+		}
+	}
+
+	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
+		return 0;
+	return fat_scan_free_clusters(sb, NULL);
+}
+
+static void fat_free_bitmap_work(struct work_struct *work)
+{
+	struct msdos_sb_info *sbi = container_of(work, struct msdos_sb_info,
+						 free_bitmap_work);
+
+	lock_fat(sbi);
+	fat_free_bitmap_build(sbi->fat_inode->i_sb);
+	unlock_fat(sbi);
+}
+
+/* Build the free bitmap in the background, so the first write need not */
+void fat_free_bitmap_start(struct super_block *sb)
+{
+	if (!(sb->s_flags & MS_RDONLY))
+		schedule_work(&MSDOS_SB(sb)->free_bitmap_work);
+}
+
+void fat_free_bitmap_release(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+
+	cancel_work_sync(&sbi->free_bitmap_work);
+	vfree(sbi->free_bitmap);
+	sbi->free_bitmap = NULL;
+}
+
+int fat_count_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	int err;
+
+	lock_fat(sbi);
+	err = fat_free_bitmap_build(sb);
 	unlock_fat(sbi);
 	return err;
 }
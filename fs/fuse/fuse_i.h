@@ -22,15 +22,24 @@
 #include <linux/rbtree.h>
 #include <linux/poll.h>
 
-/** Max number of pages that can be used in a single read request */
+/** Default max number of pages that can be used in a single request */
 #define FUSE_MAX_PAGES_PER_REQ 32
 
+/** Upper limit of fc->max_pages, i.e. 1MB requests with 4k pages */
+#define FUSE_MAX_MAX_PAGES 256
+
+/** Number of page pointers embedded in struct fuse_req */
+#define FUSE_REQ_INLINE_PAGES 1
+
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
 
 /** It could be as large as PATH_MAX, but would that have any uses? */
 #define FUSE_NAME_MAX 1024
 
+/** Max number of request queues of a connection */
+#define FUSE_MAX_QUEUES 8
+
 /** Number of dentries for each connection in the control filesystem */
 #define FUSE_CTL_NUM_DENTRIES 5
 
@@ -277,7 +286,13 @@ struct fuse_req {
 	} misc;
 
 	/** page vector */
-	struct page *pages[FUSE_MAX_PAGES_PER_REQ];
+	struct page **pages;
+
+	/** size of the page vector */
+	unsigned max_pages;
+
+	/** inline page vector, used unless more pages were asked for */
+	struct page *inline_pages[FUSE_REQ_INLINE_PAGES];
 
 	/** number of pages in vector */
 	unsigned num_pages;
@@ -299,6 +314,54 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Queue the request is on, once it is sent */
+	struct fuse_queue *fq;
+};
+
+/**
+ * A queue of requests for userspace.
+ *
+ * Each /dev/fuse file of a connection reads from and replies through
+ * one queue; requests are spread over the queues in use by the CPU
+ * they are sent from.  All fields are protected by fc->lock.
+ */
+struct fuse_queue {
+	/** Readers of the queue are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** The list of background requests set aside for later queuing */
+	struct list_head bg_queue;
+
+	/** Number of background requests currently queued for userspace */
+	unsigned active_background;
+
+	/** Number of device files bound to this queue */
+	unsigned ndevs;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+};
+
+/**
+ * An open /dev/fuse file, bound to one queue of the connection.
+ * Stored in file->private_data.
+ */
+struct fuse_dev {
+	struct fuse_conn *fc;
+	struct fuse_queue *fq;
 };
 
 /**
@@ -333,17 +396,20 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** Maximum number of pages in a single request */
+	unsigned max_pages;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Request queues */
+	struct fuse_queue queues[FUSE_MAX_QUEUES];
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** Indices of the queues in use, which requests are spread over */
+	unsigned char qmap[FUSE_MAX_QUEUES];
 
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** Number of entries in qmap */
+	unsigned nqueues;
+
+	/** Number of device files bound to the connection */
+	unsigned ndevs;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -360,15 +426,6 @@ struct fuse_conn {
 	/** Number of requests currently in the background */
 	unsigned num_background;
 
-	/** Number of background requests currently queued for userspace */
-	unsigned active_background;
-
-	/** The list of background requests set aside for later queuing */
-	struct list_head bg_queue;
-
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Flag indicating if connection is blocked.  This will be
 	    the case before the INIT reply is received, and if there
 	    are too many outstading backgrounds requests */
@@ -478,9 +535,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -634,11 +688,28 @@ struct fuse_req *fuse_request_alloc_nofs(void);
  */
 void fuse_request_free(struct fuse_req *req);
 
+/**
+ * Number of pages a request may carry, given the largest transfer the
+ * userspace side accepts.  Never less than the historical 128k.
+ */
+static inline unsigned fuse_max_pages(unsigned max_size)
+{
+	unsigned pages = DIV_ROUND_UP(max_size, PAGE_SIZE);
+
+	return clamp_t(unsigned, pages, FUSE_MAX_PAGES_PER_REQ,
+		       FUSE_MAX_MAX_PAGES);
+}
+
 /**
  * Get a request, may fail with -ENOMEM
  */
 struct fuse_req *fuse_get_req(struct fuse_conn *fc);
 
+/**
+ * Get a request with room for npages pages, may fail with -ENOMEM
+ */
+struct fuse_req *fuse_get_req_pages(struct fuse_conn *fc, unsigned npages);
+
 /**
  * Gets a requests for a file operation, always succeeds
  */
@@ -671,6 +742,21 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/**
+ * Wake up all readers of the connection
+ */
+void fuse_wake_readers(struct fuse_conn *fc);
+
+/**
+ * Allocate a device file for the connection and bind it to a queue
+ */
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+
+/**
+ * Unbind and free a device file that was never installed
+ */
+void fuse_dev_free(struct fuse_dev *fud);
+
 /**
  * Invalidate inode attributes
  */
@@ -330,8 +330,7 @@ void fuse_conn_kill(struct fuse_conn *fc)
 	fc->blocked = 0;
 	spin_unlock(&fc->lock);
 	/* Flush all readers on this fs */
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
-	wake_up_all(&fc->waitq);
+	fuse_wake_readers(fc);
 	wake_up_all(&fc->blocked_waitq);
 	wake_up_all(&fc->reserved_req_waitq);
 	mutex_lock(&fuse_mutex);
@@ -518,25 +517,37 @@ static int fuse_show_options(struct seq_file *m, struct vfsmount *mnt)
 	return 0;
 }
 
+static void fuse_queue_init(struct fuse_queue *fq)
+{
+	init_waitqueue_head(&fq->waitq);
+	INIT_LIST_HEAD(&fq->pending);
+	INIT_LIST_HEAD(&fq->processing);
+	INIT_LIST_HEAD(&fq->io);
+	INIT_LIST_HEAD(&fq->interrupts);
+	INIT_LIST_HEAD(&fq->bg_queue);
+}
+
 void fuse_conn_init(struct fuse_conn *fc)
 {
+	int i;
+
 	memset(fc, 0, sizeof(*fc));
 	spin_lock_init(&fc->lock);
 	mutex_init(&fc->inst_mutex);
 	init_rwsem(&fc->killsb);
 	atomic_set(&fc->count, 1);
-	init_waitqueue_head(&fc->waitq);
+	for (i = 0; i < FUSE_MAX_QUEUES; i++)
+		fuse_queue_init(&fc->queues[i]);
+	/* Until a device is bound, everything goes on the first queue */
+	fc->qmap[0] = 0;
+	fc->nqueues = 1;
 	init_waitqueue_head(&fc->blocked_waitq);
 	init_waitqueue_head(&fc->reserved_req_waitq);
-	INIT_LIST_HEAD(&fc->pending);
-	INIT_LIST_HEAD(&fc->processing);
-	INIT_LIST_HEAD(&fc->io);
-	INIT_LIST_HEAD(&fc->interrupts);
-	INIT_LIST_HEAD(&fc->bg_queue);
 	INIT_LIST_HEAD(&fc->entry);
 	atomic_set(&fc->num_waiting, 0);
 	fc->max_background = FUSE_DEFAULT_MAX_BACKGROUND;
 	fc->congestion_threshold = FUSE_DEFAULT_CONGESTION_THRESHOLD;
+	fc->max_pages = FUSE_MAX_PAGES_PER_REQ;
 	fc->khctr = 0;
 	fc->polled_files = RB_ROOT;
 	fc->reqctr = 0;
@@ -832,6 +843,7 @@ static void process_init_reply(struct fuse_conn *fc, struct fuse_req *req)
 		fc->minor = arg->minor;
 		fc->max_write = arg->minor < 5 ? 4096 : arg->max_write;
 		fc->max_write = max_t(unsigned, 4096, fc->max_write);
+		fc->max_pages = fuse_max_pages(fc->max_write);
 		fc->conn_init = 1;
 	}
 	fc->blocked = 0;
@@ -918,6 +930,7 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 	struct file *file;
 	struct dentry *root_dentry;
 	struct fuse_req *init_req;
+	struct fuse_dev *fud;
 	int err;
 	int is_bdev = sb->s_bdev != NULL;
 
@@ -1006,14 +1019,20 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 	if (file->private_data)
 		goto err_unlock;
 
+	err = -ENOMEM;
+	fud = fuse_dev_alloc(fc);
+	if (!fud)
+		goto err_unlock;
+
 	err = fuse_ctl_add_conn(fc);
 	if (err)
-		goto err_unlock;
+		goto err_free_dev;
 
 	list_add_tail(&fc->entry, &fuse_conn_list);
 	sb->s_root = root_dentry;
 	fc->connected = 1;
-	file->private_data = fuse_conn_get(fc);
+	fuse_conn_get(fc);
+	file->private_data = fud;
 	mutex_unlock(&fuse_mutex);
 	/*
 	 * atomic_dec_and_test() in fput() provides the necessary
@@ -1026,6 +1045,8 @@ static int fuse_fill_super(struct super_block *sb, void *data, int silent)
 
 	return 0;
 
+ err_free_dev:
+	fuse_dev_free(fud);
  err_unlock:
 	mutex_unlock(&fuse_mutex);
  err_free_init_req:
@@ -482,6 +482,128 @@ ok:
 	return security_inode_permission(inode, MAY_EXEC);
 }
 
+/*
+ * exec_permission() for the RCU walk: no reference is held on @inode
+ * and we must not sleep, so anything but a plain DAC check that grants
+ * access returns -ECHILD and is left to exec_permission().
+ */
+static int exec_permission_rcu(struct inode *inode)
+{
+	if (inode->i_op->permission)
+		return -ECHILD;
+#ifdef CONFIG_FS_POSIX_ACL
+	/* Only an ACL already known to be absent can be skipped */
+	if (IS_POSIXACL(inode) && inode->i_op->check_acl &&
+	    ACCESS_ONCE(inode->i_acl) != NULL)
+		return -ECHILD;
+#endif
+	if (acl_permission_check(inode, MAY_EXEC, NULL))
+		return -ECHILD;
+	return security_inode_exec_permission_rcu(inode);
+}
+
+static inline int sb_inode_rcu(struct super_block *sb)
+{
+	return !sb->s_op->destroy_inode ||
+		(sb->s_type->fs_flags & FS_INODE_RCU);
+}
+
+/*
+ * RCU path walk.
+ *
+ * Walk as many intermediate components of @name as possible under
+ * rcu_read_lock() alone: no dcache_lock, no d_lock and no dentry
+ * references, so that concurrent lookups through the same directories
+ * do not bounce their dentries between CPUs.  Each dentry is validated
+ * with its d_seq count instead, which d_move, d_drop and dentry_iput
+ * bump; inodes are freed after a grace period (see destroy_inode()).
+ *
+ * The walk stops in front of anything it cannot handle: the last
+ * component, "." and "..", a dcache miss, ->d_hash, ->d_compare or
+ * ->d_revalidate, a mountpoint, a symlink, a permission check that might
+ * sleep or a concurrent rename.  The last dentry reached is then pinned
+ * and becomes nd->path.dentry, and the rest of @name is returned for the
+ * ordinary ref-walk to carry on from.  If pinning fails, nothing has
+ * been consumed.
+ */
+static const char *walk_components_rcu(const char *name, struct nameidata *nd)
+{
+	struct dentry *parent = nd->path.dentry;
+	struct inode *inode = parent->d_inode;
+	const char *start = name;
+	unsigned pseq = 0;
+
+	if ((nd->flags & LOOKUP_REVAL) || !sb_inode_rcu(parent->d_sb))
+		return name;
+
+	rcu_read_lock();
+	for (;;) {
+		struct dentry *dentry;
+		struct qstr this;
+		unsigned long hash;
+		unsigned int c;
+		const char *next;
+		unsigned seq;
+
+		if (exec_permission_rcu(inode))
+			break;
+
+		this.name = (const unsigned char *)name;
+		c = *(const unsigned char *)name;
+		next = name;
+		hash = init_name_hash();
+		do {
+			next++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)next;
+		} while (c && (c != '/'));
+		this.len = next - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		/* leave the last component to link_path_walk() */
+		if (!c)
+			break;
+		while (*++next == '/');
+		if (!*next)
+			break;
+
+		if (this.name[0] == '.' && (this.len == 1 ||
+		    (this.len == 2 && this.name[1] == '.')))
+			break;
+		if (parent->d_op &&
+		    (parent->d_op->d_hash || parent->d_op->d_compare))
+			break;
+
+		dentry = __d_lookup_rcu(parent, &this, &seq);
+		if (!dentry)
+			break;
+		if (dentry->d_mounted ||
+		    (dentry->d_op && dentry->d_op->d_revalidate))
+			break;
+		inode = dentry->d_inode;
+		if (read_seqcount_retry(&dentry->d_seq, seq) || !inode)
+			break;
+		if (inode->i_op->follow_link || !inode->i_op->lookup)
+			break;
+
+		parent = dentry;
+		pseq = seq;
+		name = next;
+	}
+
+	if (parent != nd->path.dentry) {
+		if (d_rcu_to_refcount(parent, pseq)) {
+			rcu_read_unlock();
+			dput(nd->path.dentry);
+			nd->path.dentry = parent;
+			return name;
+		}
+		name = start;
+	}
+	rcu_read_unlock();
+	return name;
+}
+
 static __always_inline void set_root(struct nameidata *nd)
 {
 	if (!nd->root.mnt)
@@ -838,6 +960,8 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 		unsigned int c;
 
 		nd->flags |= LOOKUP_CONTINUE;
+		name = walk_components_rcu(name, nd);
+		inode = nd->path.dentry->d_inode;
 		err = exec_permission(inode);
  		if (err)
 			break;
@@ -65,6 +65,7 @@
 struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 	struct squashfs_cache *cache, u64 block, int length)
 {
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
 	int i, n;
 	struct squashfs_cache_entry *entry;
 
@@ -116,6 +117,10 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 			entry->error = 0;
 			spin_unlock(&cache->lock);
 
+			/* Only the metadata cache reads with a zero length */
+			if (length)
+				atomic_long_inc(&msblk->blocks_read);
+
 			entry->length = squashfs_read_data(sb, entry->data,
 				block, length, &entry->next_index,
 				cache->block_size, cache->pages);
@@ -24,6 +24,7 @@
 #include <linux/types.h>
 #include <linux/mutex.h>
 #include <linux/buffer_head.h>
+#include <linux/percpu.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -72,3 +73,80 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 
 	return decompressor[i];
 }
+
+
+/*
+ * Decompressor streams.  By default every possible CPU gets a stream of
+ * its own, so readers on different CPUs decompress in parallel instead of
+ * queueing on a single stream.  The decompressors may sleep waiting for
+ * buffers, so each stream still has a mutex: a reader migrated mid-block
+ * keeps its stream and only contends with whoever now runs on that CPU.
+ * Mounting with threads=single gives one stream for the filesystem.
+ */
+int squashfs_decompressor_create(struct squashfs_sb_info *msblk, int percpu)
+{
+	struct squashfs_stream *stream;
+	int cpu;
+
+	msblk->stream = alloc_percpu(struct squashfs_stream);
+	if (msblk->stream == NULL)
+		goto failed;
+
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(msblk->stream, cpu);
+		mutex_init(&stream->mutex);
+		if (!percpu && msblk->single_stream)
+			continue;
+
+		stream->stream = msblk->decompressor->init(msblk);
+		if (stream->stream == NULL)
+			goto failed;
+		if (!percpu)
+			msblk->single_stream = stream;
+	}
+
+	return 0;
+
+failed:
+	squashfs_decompressor_destroy(msblk);
+	return -ENOMEM;
+}
+
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream;
+	int cpu;
+
+	if (msblk->stream == NULL)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(msblk->stream, cpu);
+		if (stream->stream)
+			msblk->decompressor->free(stream->stream);
+	}
+
+	free_percpu(msblk->stream);
+	msblk->stream = NULL;
+	msblk->single_stream = NULL;
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *stream = msblk->single_stream;
+	int res;
+
+	if (stream == NULL)
+		stream = per_cpu_ptr(msblk->stream, raw_smp_processor_id());
+
+	mutex_lock(&stream->mutex);
+	res = msblk->decompressor->decompress(msblk, stream->stream, buffer,
+		bh, b, offset, length, srclength, pages);
+	mutex_unlock(&stream->mutex);
+
+	return res;
+}
@@ -371,7 +371,114 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
-static int squashfs_readpage(struct file *file, struct page *page)
+/*
+ * Get page index of the block from the page cache, taking it off the
+ * readahead list if readpages already allocated it.  The readahead list is
+ * in ascending index order from its tail, so only the tail needs checking.
+ * Returns the page locked and with a reference held, or NULL.
+ */
+static struct page *squashfs_grab_page(struct address_space *mapping,
+	pgoff_t index, struct list_head *readahead)
+{
+	if (readahead && !list_empty(readahead)) {
+		struct page *page = list_entry(readahead->prev, struct page,
+			lru);
+
+		if (page->index == index) {
+			list_del(&page->lru);
+			if (add_to_page_cache_lru(page, mapping, index,
+						GFP_KERNEL) == 0)
+				return page;
+			page_cache_release(page);
+		}
+	}
+
+	return grab_cache_page_nowait(mapping, index);
+}
+
+
+/*
+ * Decompress a whole datablock straight into the page cache, skipping the
+ * read_page cache and the copy out of it.  This needs every page the block
+ * covers to be grabbed, not uptodate and in lowmem; otherwise -EAGAIN is
+ * returned and the caller goes through the cache as before.  On success
+ * all the pages, including the one asked for, are uptodate and unlocked.
+ */
+static int squashfs_readpage_block(struct page *target_page, u64 block,
+	int bsize, int expected, struct list_head *readahead)
+{
+	struct address_space *mapping = target_page->mapping;
+	struct squashfs_sb_info *msblk = mapping->host->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int pages = (expected + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	int tail = expected & (PAGE_CACHE_SIZE - 1);
+	struct page **page;
+	void **pageaddr;
+	int i, n, res = -EAGAIN;
+
+	page = kmalloc(pages * (sizeof(*page) + sizeof(*pageaddr)), GFP_KERNEL);
+	if (page == NULL)
+		return -EAGAIN;
+	pageaddr = (void **) (page + pages);
+
+	for (n = 0; n < pages; n++) {
+		page[n] = (start_index + n == target_page->index) ? target_page :
+			squashfs_grab_page(mapping, start_index + n, readahead);
+		if (page[n] == NULL)
+			goto release;
+		if ((page[n] != target_page && PageUptodate(page[n])) ||
+				PageHighMem(page[n])) {
+			n++;
+			goto release;
+		}
+		pageaddr[n] = page_address(page[n]);
+	}
+
+	/*
+	 * Only pages entries are mapped: bound both the stored and the
+	 * decompressed size by expected, so a corrupt block can't be
+	 * read past the end of pageaddr.
+	 */
+	atomic_long_inc(&msblk->blocks_read);
+	res = squashfs_read_data(mapping->host->i_sb, pageaddr, block, bsize,
+		NULL, expected, pages);
+	if (res != expected) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		res = -EIO;
+		goto release;
+	}
+
+	if (tail)
+		memset(pageaddr[pages - 1] + tail, 0, PAGE_CACHE_SIZE - tail);
+
+	atomic_long_add(pages, &msblk->pages_filled);
+
+	for (i = 0; i < pages; i++) {
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+	kfree(page);
+	return 0;
+
+release:
+	/* The target page is left locked for the caller */
+	for (i = 0; i < n; i++) {
+		if (page[i] == target_page)
+			continue;
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+	kfree(page);
+	return res;
+}
+
+
+static int __squashfs_readpage(struct page *page, struct list_head *readahead)
 {
 	struct inode *inode = page->mapping->host;
 	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
@@ -410,8 +517,19 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Decompress the datablock straight into the page
+			 * cache if possible, else read and decompress it
+			 * into the read_page cache.
 			 */
+			int res = squashfs_readpage_block(page, block, bsize,
+				index == file_end ? (i_size_read(inode) &
+				(msblk->block_size - 1)) : msblk->block_size,
+				readahead);
+			if (res == 0)
+				return 0;
+			if (res != -EAGAIN)
+				goto error_out;
+
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
 			if (buffer->error) {
@@ -456,7 +574,7 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		TRACE("bytes %d, i %d, available_bytes %d\n", bytes, i, avail);
 
 		push_page = (i == page->index) ? page :
-			grab_cache_page_nowait(page->mapping, i);
+			squashfs_grab_page(page->mapping, i, readahead);
 
 		if (!push_page)
 			continue;
@@ -470,6 +588,7 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		kunmap_atomic(pageaddr, KM_USER0);
 		flush_dcache_page(push_page);
 		SetPageUptodate(push_page);
+		atomic_long_inc(&msblk->pages_filled);
 skip_page:
 		unlock_page(push_page);
 		if (i != page->index)
@@ -496,6 +615,36 @@ out:
 }
 
 
+static int squashfs_readpage(struct file *file, struct page *page)
+{
+	return __squashfs_readpage(page, NULL);
+}
+
+
+/*
+ * Readahead.  Each block is decompressed once, the first page of the block
+ * on the list pulling the rest of the block's pages off the list and into
+ * the page cache as it is filled, rather than every page going through
+ * readpage and the read_page cache in turn.
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					GFP_KERNEL) == 0)
+			__squashfs_readpage(page, pages);
+		page_cache_release(page);
+	}
+
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
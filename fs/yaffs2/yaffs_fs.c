@@ -190,6 +190,7 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino);
 		} while(0)
 		
 static void yaffs_put_super(struct super_block *sb);
+static void yaffs_BackgroundKick(yaffs_Device *dev);
 
 static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 				loff_t *pos);
@@ -411,14 +412,29 @@ static unsigned yaffs_gc_control_callback(yaffs_Device *dev)
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking %p\n"), current));
-	down(&(yaffs_DeviceToContext(dev)->grossLock));
+	mutex_lock(&(yaffs_DeviceToContext(dev)->grossLock));
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked %p\n"), current));
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking %p\n"), current));
-	up(&(yaffs_DeviceToContext(dev)->grossLock));
+	mutex_unlock(&(yaffs_DeviceToContext(dev)->grossLock));
+}
+
+/*
+ * yaffs_guts brackets every change to directory membership and object
+ * names with this callback, always under the gross lock, so readers can
+ * walk a directory under nameSeq alone.
+ */
+static void yaffs_NameChangeCallback(yaffs_Device *dev, int done)
+{
+	seqcount_t *seq = &yaffs_DeviceToContext(dev)->nameSeq;
+
+	if (done)
+		write_seqcount_end(seq);
+	else
+		write_seqcount_begin(seq);
 }
 
 #ifdef YAFFS_COMPILE_EXPORTFS
@@ -658,6 +674,65 @@ out:
 struct inode *yaffs_get_inode(struct super_block *sb, int mode, int dev,
 				yaffs_Object *obj);
 
+/*
+ * Find name in dir without the gross lock. Objects are never handed back
+ * to the kernel while mounted, so a walk racing with a change reads
+ * stale but valid memory, and the nameSeq check throws its result away.
+ * Returns the object id, 0 if the name is not there, or -1 if the
+ * lookup must be done under the lock: the directory changed, or a name
+ * is not in RAM yet (lazy loading, long names, made-up names).
+ */
+static int yaffs_LookupNoLock(yaffs_Object *dir, const YCHAR *name)
+{
+#if defined(CONFIG_YAFFS_SHORT_NAMES_IN_RAM) && \
+	!defined(CONFIG_YAFFS_VALGRIND_TEST) && \
+	!defined(CONFIG_YAFFS_CASE_INSENSITIVE)
+	seqcount_t *seq = &yaffs_DeviceToContext(dir->myDev)->nameSeq;
+	struct ylist_head *head = &dir->variant.directoryVariant.children;
+	struct ylist_head *i;
+	yaffs_Object *l;
+	unsigned start;
+	int id = 0;
+
+	/* Long names only live on NAND */
+	if (yaffs_strnlen(name, YAFFS_SHORT_NAME_LENGTH + 1) >
+	    YAFFS_SHORT_NAME_LENGTH)
+		return -1;
+
+	start = read_seqcount_begin(seq);
+	for (i = head->next; i != head; i = i->next) {
+		if (!i || read_seqcount_retry(seq, start))
+			return -1;
+		l = ylist_entry(i, yaffs_Object, siblings);
+
+		if (l->objectId == YAFFS_OBJECTID_LOSTNFOUND) {
+			if (yaffs_strcmp(name, YAFFS_LOSTNFOUND_NAME) == 0) {
+				id = l->objectId;
+				break;
+			}
+			continue;
+		}
+		if (l->lazyLoaded || l->hdrChunk <= 0)
+			return -1;
+		/* An empty short name is a long one, which can't match */
+		if (l->shortName[0] &&
+		    yaffs_strcmp(name, l->shortName) == 0) {
+			/* The link target may be going away: take the lock */
+			if (l->variantType == YAFFS_OBJECT_TYPE_HARDLINK)
+				return -1;
+			id = l->objectId;
+			break;
+		}
+	}
+
+	if (read_seqcount_retry(seq, start))
+		return -1;
+	return id;
+#else
+	return -1;
+#endif
+}
+
 /*
  * Lookup is used to find objects in the fs
  */
@@ -671,11 +746,26 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 {
 	yaffs_Object *obj;
 	struct inode *inode = NULL;	/* NCB 2.5/2.6 needs NULL here */
+	int id;
 
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
-	if(current != yaffs_DeviceToContext(dev)->readdirProcess)
-		yaffs_GrossLock(dev);
+	id = yaffs_LookupNoLock(yaffs_InodeToObject(dir),
+				(const YCHAR *)dentry->d_name.name);
+	if (id >= 0) {
+		T(YAFFS_TRACE_OS,
+			(TSTR("yaffs_lookup unlocked %s found %d\n"),
+			dentry->d_name.name, id));
+		if (id) {
+			inode = Y_IGET(dir->i_sb, id);
+			if (IS_ERR(inode))
+				inode = NULL;
+		}
+		d_add(dentry, inode);
+		return NULL;
+	}
+
+	yaffs_GrossLock(dev);
 
 	T(YAFFS_TRACE_OS,
 		(TSTR("yaffs_lookup for %d:%s\n"),
@@ -687,8 +777,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 	obj = yaffs_GetEquivalentObject(obj);	/* in case it was a hardlink */
 
 	/* Can't hold gross lock when calling yaffs_get_inode() */
-	if(current != yaffs_DeviceToContext(dev)->readdirProcess)
-		yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlock(dev);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -960,6 +1049,7 @@ static int yaffs_writepage(struct page *page)
 
 	nWritten = yaffs_WriteDataToFile(obj, buffer,
 			page->index << PAGE_CACHE_SHIFT, nBytes, 0);
+	yaffs_BackgroundKick(obj->myDev);
 
 	T(YAFFS_TRACE_OS,
 		(TSTR("writepag1: obj = %05x, ino = %05x\n"),
@@ -1300,6 +1390,7 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 			(unsigned) n, (unsigned) n, obj->objectId, ipos,ipos));
 
 	nWritten = yaffs_WriteDataToFile(obj, buf, ipos, n, 0);
+	yaffs_BackgroundKick(dev);
 
 	T(YAFFS_TRACE_OS,
 		(TSTR("yaffs_file_write: %d(%x) bytes written\n"),
@@ -1391,6 +1482,20 @@ static loff_t yaffs_dir_llseek(struct file *file, loff_t offset, int origin)
 }
 
 
+/*
+ * readdir takes a snapshot of up to YAFFS_READDIR_BATCH entries under the
+ * gross lock and hands them to filldir() with the lock dropped, so that
+ * neither copying to user space nor lookups done by filldir() hold up
+ * other users of the device.
+ */
+#define YAFFS_READDIR_BATCH	16
+
+struct yaffs_DirentSnapshot {
+	int inode;
+	int type;
+	char name[YAFFS_MAX_NAME_LENGTH + 1];
+};
+
 static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 {
 	yaffs_Object *obj;
@@ -1399,35 +1504,27 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 	struct inode *inode = f->f_dentry->d_inode;
 	unsigned long offset, curoffs;
 	yaffs_Object *l;
+	struct yaffs_DirentSnapshot *snap;
+	int i, n;
         int retVal = 0;
 
-	char name[YAFFS_MAX_NAME_LENGTH + 1];
-
 	obj = yaffs_DentryToObject(f->f_dentry);
 	dev = obj->myDev;
 
-	yaffs_GrossLock(dev);
-
-	yaffs_DeviceToContext(dev)->readdirProcess = current;
+	snap = kmalloc(YAFFS_READDIR_BATCH * sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
 
 	offset = f->f_pos;
 
-        sc = yaffs_NewSearch(obj);
-        if(!sc){
-                retVal = -ENOMEM;
-                goto unlock_out;
-        }
-
 	T(YAFFS_TRACE_OS, (TSTR("yaffs_readdir: starting at %d\n"), (int)offset));
 
 	if (offset == 0) {
 		T(YAFFS_TRACE_OS,
 			(TSTR("yaffs_readdir: entry . ino %d \n"),
 			(int)inode->i_ino));
-		yaffs_GrossUnlock(dev);
 		if (filldir(dirent, ".", 1, offset, inode->i_ino, DT_DIR) < 0)
 			goto out;
-		yaffs_GrossLock(dev);
 		offset++;
 		f->f_pos++;
 	}
@@ -1435,15 +1532,21 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 		T(YAFFS_TRACE_OS,
 			(TSTR("yaffs_readdir: entry .. ino %d \n"),
 			(int)f->f_dentry->d_parent->d_inode->i_ino));
-		yaffs_GrossUnlock(dev);
 		if (filldir(dirent, "..", 2, offset,
 			f->f_dentry->d_parent->d_inode->i_ino, DT_DIR) < 0)
 			goto out;
-		yaffs_GrossLock(dev);
 		offset++;
 		f->f_pos++;
 	}
 
+	yaffs_GrossLock(dev);
+
+        sc = yaffs_NewSearch(obj);
+        if(!sc){
+                retVal = -ENOMEM;
+                goto unlock_out;
+        }
+
 	curoffs = 1;
 
 	/* If the directory has changed since the open or last call to
@@ -1455,42 +1558,50 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 	}
 
 	while(sc->nextReturn){
-		curoffs++;
-                l = sc->nextReturn;
-		if (curoffs >= offset) {
-                        int this_inode = yaffs_GetObjectInode(l);
-                        int this_type = yaffs_GetObjectType(l);
+		for (n = 0; sc->nextReturn && n < YAFFS_READDIR_BATCH;
+		     yaffs_SearchAdvance(sc)) {
+			curoffs++;
+			l = sc->nextReturn;
+			if (curoffs < offset)
+				continue;
 
-			yaffs_GetObjectName(l, name,
+			snap[n].inode = yaffs_GetObjectInode(l);
+			snap[n].type = yaffs_GetObjectType(l);
+			yaffs_GetObjectName(l, snap[n].name,
 					    YAFFS_MAX_NAME_LENGTH + 1);
 			T(YAFFS_TRACE_OS,
 			  (TSTR("yaffs_readdir: %s inode %d\n"),
-			  name, yaffs_GetObjectInode(l)));
+			  snap[n].name, snap[n].inode));
+			n++;
+		}
 
-                        yaffs_GrossUnlock(dev);
+		/* The search context keeps our place while unlocked */
+		yaffs_GrossUnlock(dev);
 
+		for (i = 0; i < n; i++) {
 			if (filldir(dirent,
-					name,
-					strlen(name),
+					snap[i].name,
+					strlen(snap[i].name),
 					offset,
-					this_inode,
-					this_type) < 0)
-				goto out;
-
-                        yaffs_GrossLock(dev);
+					snap[i].inode,
+					snap[i].type) < 0)
+				break;
 
 			offset++;
 			f->f_pos++;
 		}
-                yaffs_SearchAdvance(sc);
+
+		yaffs_GrossLock(dev);
+
+		if (i < n)
+			break;
 	}
 
+	yaffs_EndSearch(sc);
 unlock_out:
-	yaffs_DeviceToContext(dev)->readdirProcess = NULL;
-
 	yaffs_GrossUnlock(dev);
 out:
-        yaffs_EndSearch(sc);
+	kfree(snap);
 
 	return retVal;
 }
@@ -2007,6 +2118,12 @@ static int yaffs_do_sync_fs(struct super_block *sb,
  * yaffs_BackgroundThread() the thread function
  * yaffs_BackgroundStart() launches the background thread.
  * yaffs_BackgroundStop() cleans up the background thread.
+ * yaffs_BackgroundKick() notes a write and wakes the thread if space is tight.
+ *
+ * Leisurely gc (urgency 0 or 1) is held off until writes have paused for
+ * YAFFS_BG_IDLE_TIME so it does not compete with the writer for the lock.
+ * Urgent gc runs straight away so the writer doesn't end up doing it
+ * itself in the foreground.
  *
  * NB: 
  * The thread should only run after the yaffs is initialised
@@ -2016,6 +2133,8 @@ static int yaffs_do_sync_fs(struct super_block *sb,
 
 #ifdef YAFFS_COMPILE_BACKGROUND
 
+#define YAFFS_BG_IDLE_TIME	(HZ/10)
+
 void yaffs_background_waker(unsigned long data)
 {
 	wake_up_process((struct task_struct *)data);
@@ -2059,9 +2178,14 @@ static int yaffs_BackgroundThread(void *data)
 			next_dir_update = now + HZ;
 		}
 
-		if(time_after(now,next_gc)){
-			if(!dev->isCheckpointed){
-				urgency = yaffs_bg_gc_urgency(dev);
+		if(context->bgKicked || time_after(now,next_gc)){
+			context->bgKicked = 0;
+			urgency = yaffs_bg_gc_urgency(dev);
+			if(!dev->isCheckpointed && urgency < 2 &&
+				time_before(now, context->lastWrite + YAFFS_BG_IDLE_TIME)){
+				/* Still busy writing, come back when idle */
+				next_gc = context->lastWrite + YAFFS_BG_IDLE_TIME;
+			} else if(!dev->isCheckpointed){
 				gcResult = yaffs_BackgroundGarbageCollect(dev, urgency);
 				if(urgency > 1)
 					next_gc = now + HZ/20+1;
@@ -2090,7 +2214,10 @@ static int yaffs_BackgroundThread(void *data)
 
                 set_current_state(TASK_INTERRUPTIBLE);
 		add_timer(&timer);
-		schedule();
+		/* A kick that came in since the lock was dropped */
+		if(!context->bgKicked)
+			schedule();
+		__set_current_state(TASK_RUNNING);
 		del_timer_sync(&timer);
 #else
 		msleep(10);
@@ -2106,6 +2233,8 @@ static int yaffs_BackgroundStart(yaffs_Device *dev)
 	struct yaffs_LinuxContext *context = yaffs_DeviceToContext(dev);
 
 	context->bgRunning = 1;
+	context->bgKicked = 0;
+	context->lastWrite = jiffies - YAFFS_BG_IDLE_TIME;
 
 	context->bgThread = kthread_run(yaffs_BackgroundThread,
 	                        (void *)dev,"yaffs-bg");
@@ -2129,6 +2258,20 @@ static void yaffs_BackgroundStop(yaffs_Device *dev)
 		ctxt->bgThread = NULL;
 	}
 }
+
+/* Called with the gross lock held */
+static void yaffs_BackgroundKick(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *ctxt = yaffs_DeviceToContext(dev);
+
+	ctxt->lastWrite = jiffies;
+
+	/* Set under the lock, so the thread can't miss it for next_gc */
+	if(ctxt->bgThread && yaffs_bg_gc_urgency(dev) > 1){
+		ctxt->bgKicked = 1;
+		wake_up_process(ctxt->bgThread);
+	}
+}
 #else
 static int yaffs_BackgroundThread(void *data)
 {
@@ -2143,6 +2286,10 @@ static int yaffs_BackgroundStart(yaffs_Device *dev)
 static void yaffs_BackgroundStop(yaffs_Device *dev)
 {
 }
+
+static void yaffs_BackgroundKick(yaffs_Device *dev)
+{
+}
 #endif
 
 
@@ -2232,15 +2379,13 @@ static void yaffs_read_inode(struct inode *inode)
 	T(YAFFS_TRACE_OS,
 		(TSTR("yaffs_read_inode for %d\n"), (int)inode->i_ino));
 
-	if(current != yaffs_DeviceToContext(dev)->readdirProcess)
-		yaffs_GrossLock(dev);
+	yaffs_GrossLock(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	if(current != yaffs_DeviceToContext(dev)->readdirProcess)
-		yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlock(dev);
 }
 
 #endif
@@ -2338,6 +2483,8 @@ typedef struct {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int cache_size;
+	int summary;
 	int tags_ecc_on;
 	int tags_ecc_overridden;
 	int lazy_loading_enabled;
@@ -2392,6 +2539,18 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 			options->empty_lost_and_found_overridden=1;
 		} else if (!strcmp(cur_opt, "no-cache"))
 			options->no_cache = 1;
+		else if (!strncmp(cur_opt, "cache-size=", 11)) {
+			options->cache_size =
+				simple_strtoul(cur_opt + 11, NULL, 0);
+			if (options->cache_size < 1 ||
+			    options->cache_size > YAFFS_MAX_SHORT_OP_CACHES) {
+				printk(KERN_INFO
+					"yaffs: cache-size must be 1..%d\n",
+					YAFFS_MAX_SHORT_OP_CACHES);
+				error = 1;
+			}
+		} else if (!strcmp(cur_opt, "summary"))
+			options->summary = 1;
 		else if (!strcmp(cur_opt, "no-checkpoint-read"))
 			options->skip_checkpoint_read = 1;
 		else if (!strcmp(cur_opt, "no-checkpoint-write"))
@@ -2421,6 +2580,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	struct mtd_info *mtd;
 	int err;
 	char *data_str = (char *)data;
+	unsigned long mount_start;
 	struct yaffs_LinuxContext *context = NULL;
 	yaffs_DeviceParam *param;
 
@@ -2631,8 +2791,10 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	param->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	param->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	param->nReservedBlocks = 5;
-	param->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	param->nShortOpCaches = (options.no_cache) ? 0 :
+				(options.cache_size) ? options.cache_size : 10;
 	param->inbandTags = options.inband_tags;
+	param->enableSummary = options.summary;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
 	param->disableLazyLoad = 1;
@@ -2732,16 +2894,28 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         /* Directory search handling...*/
         YINIT_LIST_HEAD(&(yaffs_DeviceToContext(dev)->searchContexts));
         param->removeObjectCallback = yaffs_RemoveObjectCallback;
+	param->nameChangeCallback = yaffs_NameChangeCallback;
 
-	init_MUTEX(&(yaffs_DeviceToContext(dev)->grossLock));
+	mutex_init(&(yaffs_DeviceToContext(dev)->grossLock));
+	seqcount_init(&(yaffs_DeviceToContext(dev)->nameSeq));
 
 	yaffs_GrossLock(dev);
 
+	mount_start = jiffies;
 	err = yaffs_GutsInitialise(dev);
 
 	T(YAFFS_TRACE_OS,
 	  (TSTR("yaffs_read_super: guts initialised %s\n"),
 	   (err == YAFFS_OK) ? "OK" : "FAILED"));
+
+	if (err == YAFFS_OK)
+		printk(KERN_INFO
+			"yaffs: %s mounted in %u ms, %s: %u blocks from summary,"
+			" %u scanned in full\n",
+			yaffs_devname(sb, devname_buf),
+			jiffies_to_msecs(jiffies - mount_start),
+			dev->isCheckpointed ? "checkpoint" : "scan",
+			dev->nSummaryScans, dev->nFullScans);
 	   
 	if(err == YAFFS_OK)
 		yaffs_BackgroundStart(dev);
@@ -2937,6 +3111,15 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "refreshCount....... %u\n", dev->refreshCount);
 	buf +=
 	    sprintf(buf, "nBackgroudDeletions %u\n", dev->nBackgroundDeletions);
+	buf += sprintf(buf, "cacheMisses........ %u\n", dev->cacheMisses);
+	buf += sprintf(buf, "cacheEvictions..... %u\n", dev->cacheEvictions);
+	buf += sprintf(buf, "cacheWritebacks.... %u\n", dev->cacheWritebacks);
+	buf += sprintf(buf, "foregroundGCs...... %u\n", dev->foregroundGCs);
+	buf += sprintf(buf, "foregroundGCCopies. %u\n", dev->foregroundGCCopies);
+	buf += sprintf(buf, "gcStalls........... %u\n", dev->gcStalls);
+	buf += sprintf(buf, "chunksPerSummary... %d\n", dev->chunksPerSummary);
+	buf += sprintf(buf, "nSummaryScans...... %u\n", dev->nSummaryScans);
+	buf += sprintf(buf, "nFullScans......... %u\n", dev->nFullScans);
 
 	return buf;
 }
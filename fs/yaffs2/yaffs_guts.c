@@ -28,6 +28,7 @@
 
 #include "yaffs_nand.h"
 #include "yaffs_packedtags2.h"
+#include "yaffs_summary.h"
 
 
 /* Note YAFFS_GC_GOOD_ENOUGH must be <= YAFFS_GC_PASSIVE_THRESHOLD */
@@ -472,7 +473,7 @@ static void yaffs_VerifyBlock(yaffs_Device *dev, yaffs_BlockInfo *bi, int n)
 
 
 	/* Check chunk bitmap legal */
-	inUse = yaffs_CountChunkBits(dev, n);
+	inUse = yaffs_CountChunkBits(dev, n) + yaffs_SummaryChunksInUse(dev, bi);
 	if (inUse != bi->pagesInUse)
 		T(YAFFS_TRACE_VERIFY, (TSTR("Block %d has inconsistent values pagesInUse %d counted chunk bits %d"TENDSTR),
 			n, bi->pagesInUse, inUse));
@@ -1039,6 +1040,8 @@ static int yaffs_WriteNewChunkWithTagsToNAND(struct yaffs_DeviceStruct *dev,
 		/* Copy the data into the robustification buffer */
 		yaffs_HandleWriteChunkOk(dev, chunk, data, tags);
 
+		yaffs_SummaryAdd(dev, tags, chunk);
+
 	} while (writeOk != YAFFS_OK &&
 		(yaffs_wr_attempts <= 0 || attempts <= yaffs_wr_attempts));
 
@@ -1239,6 +1242,12 @@ static void yaffs_HandleWriteChunkError(yaffs_Device *dev, int chunkInNAND,
 
 /*---------------- Name handling functions ------------*/
 
+static void yaffs_NameChange(yaffs_Device *dev, int done)
+{
+	if (dev && dev->param.nameChangeCallback)
+		dev->param.nameChangeCallback(dev, done);
+}
+
 static __u16 yaffs_CalcNameSum(const YCHAR *name)
 {
 	__u16 sum = 0;
@@ -1262,6 +1271,7 @@ static __u16 yaffs_CalcNameSum(const YCHAR *name)
 
 static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
 {
+	yaffs_NameChange(obj->myDev, 0);
 #ifdef CONFIG_YAFFS_SHORT_NAMES_IN_RAM
 	memset(obj->shortName, 0, sizeof(YCHAR) * (YAFFS_SHORT_NAME_LENGTH+1));
 	if (name && yaffs_strnlen(name,YAFFS_SHORT_NAME_LENGTH+1) <= YAFFS_SHORT_NAME_LENGTH)
@@ -1270,6 +1280,7 @@ static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
 		obj->shortName[0] = _Y('\0');
 #endif
 	obj->sum = yaffs_CalcNameSum(name);
+	yaffs_NameChange(obj->myDev, 1);
 }
 
 /*-------------------- TNODES -------------------
@@ -2103,8 +2114,10 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device *dev)
 
 		/* Now make the directory sane */
 		if (dev->rootDir) {
+			yaffs_NameChange(dev, 0);
 			tn->parent = dev->rootDir;
 			ylist_add(&(tn->siblings), &dev->rootDir->variant.directoryVariant.children);
+			yaffs_NameChange(dev, 1);
 		}
 
 		/* Add it to the lost and found directory.
@@ -2857,6 +2870,13 @@ static void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
 
 	bi->blockState = YAFFS_BLOCK_STATE_DIRTY;
 
+	/* The summary chunks go back to the free space with the block */
+	if (bi->hasSummary) {
+		dev->nFreeChunks += dev->summaryChunks;
+		bi->pagesInUse -= dev->summaryChunks;
+		bi->hasSummary = 0;
+	}
+
 	/* If this is the block being garbage collected then stop gc'ing this block */
 	if(blockNo == dev->gcBlock)
 		dev->gcBlock = 0;
@@ -3540,6 +3560,7 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 	int aggressive = 0;
 	int gcOk = YAFFS_OK;
 	int maxTries = 0;
+	__u32 copiesBefore;
 
 	int minErased;
 	int erasedChunks;
@@ -3608,7 +3629,16 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 			   ("yaffs: GC erasedBlocks %d aggressive %d" TENDSTR),
 			   dev->nErasedBlocks, aggressive));
 
+			copiesBefore = dev->nGCCopies;
 			gcOk = yaffs_GarbageCollectBlock(dev, dev->gcBlock, aggressive);
+
+			/* Account for gc work done on behalf of a writer */
+			if (!background) {
+				dev->foregroundGCs++;
+				dev->foregroundGCCopies += dev->nGCCopies - copiesBefore;
+				if (aggressive)
+					dev->gcStalls++;
+			}
 		}
 
 		if (dev->nErasedBlocks < (dev->param.nReservedBlocks) && dev->gcBlock > 0) {
@@ -3973,7 +4003,7 @@ void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn)
 
 		bi->pagesInUse--;
 
-		if (bi->pagesInUse == 0 &&
+		if (bi->pagesInUse == yaffs_SummaryChunksInUse(dev, bi) &&
 		    !bi->hasShrinkHeader &&
 		    bi->blockState != YAFFS_BLOCK_STATE_ALLOCATING &&
 		    bi->blockState != YAFFS_BLOCK_STATE_NEEDS_SCANNING) {
@@ -4225,10 +4255,40 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Cache chunks are hashed by (objectId, chunkId) so lookups do not depend
+ *   on the cache size, and replaced with the CLOCK algorithm: the hand
+ *   sweeps over the chunks, giving recently used ones a second chance.
+ *   When a dirty chunk has to go, all the dirty chunks of its object are
+ *   written out together, in chunk order.
  */
 
+static struct ylist_head *yaffs_CacheHashHead(yaffs_Device *dev,
+					      const yaffs_Object *obj,
+					      int chunkId)
+{
+	__u32 h = (obj->objectId << 8) ^ chunkId;
+
+	return &dev->srCacheHash[h & dev->srCacheHashMask];
+}
+
+static void yaffs_CacheInsert(yaffs_Device *dev, yaffs_ChunkCache *cache,
+			      yaffs_Object *obj, int chunkId)
+{
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+	cache->referenced = 0;
+	ylist_add(&cache->hashLink, yaffs_CacheHashHead(dev, obj, chunkId));
+}
+
+static void yaffs_CacheRemove(yaffs_ChunkCache *cache)
+{
+	ylist_del_init(&cache->hashLink);
+	cache->object = NULL;
+	cache->dirty = 0;
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
@@ -4246,54 +4306,60 @@ static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 	return 0;
 }
 
+static int yaffs_CacheChunkCompare(const void *a, const void *b)
+{
+	const yaffs_ChunkCache *ca = *(const yaffs_ChunkCache * const *)a;
+	const yaffs_ChunkCache *cb = *(const yaffs_ChunkCache * const *)b;
+
+	return ca->chunkId - cb->chunkId;
+}
 
 static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
+	yaffs_ChunkCache **list = dev->srCacheFlushList;
 	yaffs_ChunkCache *cache;
-	int chunkWritten = 0;
+	int chunkWritten = 1;
 	int nCaches = obj->myDev->param.nShortOpCaches;
+	int n = 0;
+	int i;
 
-	if (nCaches > 0) {
-		do {
-			cache = NULL;
-
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
-			}
+	if (nCaches < 1)
+		return;
 
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+	/* Gather the object's dirty chunks... */
+	for (i = 0; i < nCaches; i++) {
+		cache = &dev->srCache[i];
+		if (cache->object == obj && cache->dirty)
+			list[n++] = cache;
+	}
 
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
-			}
+	/* ...and write them out in order, so they land in sequential chunks */
+	if (n > 1)
+		yaffs_qsort(list, n, sizeof(list[0]), yaffs_CacheChunkCompare);
 
-		} while (cache && chunkWritten > 0);
+	for (i = 0; i < n && chunkWritten > 0; i++) {
+		cache = list[i];
 
-		if (cache) {
-			/* Hoosterman, disk full while writing cache out. */
-			T(YAFFS_TRACE_ERROR,
-			  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
+		/* Can't flush a locked chunk, nor anything after it */
+		if (cache->locked)
+			break;
+
+		chunkWritten =
+		    yaffs_WriteChunkDataToObject(cache->object,
+						 cache->chunkId,
+						 cache->data,
+						 cache->nBytes,
+						 1);
+		yaffs_CacheRemove(cache);
+		dev->cacheWritebacks++;
+	}
+
+	if (chunkWritten <= 0) {
+		/* Hoosterman, disk full while writing cache out. */
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
 
-		}
 	}
 
 }
@@ -4329,73 +4395,52 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 
 
 /* Grab us a cache chunk for use.
- * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Sweep the clock hand for a free chunk or an unreferenced clean one,
+ * clearing reference bits as we go. If a whole lap only turns up dirty
+ * chunks, flush the object of the first unreferenced one we passed and
+ * take its chunk.
  */
-static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
-{
-	int i;
-
-	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
-	}
-
-	return NULL;
-}
-
 static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 {
+	int nCaches = dev->param.nShortOpCaches;
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
+	yaffs_ChunkCache *victim = NULL;
 	int i;
-	int pushout;
-
-	if (dev->param.nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
-		cache = yaffs_GrabChunkCacheWorker(dev);
-
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
 
-			/* With locking we can't assume we can use entry zero */
-
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
-
-			for (i = 0; i < dev->param.nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
+	if (nCaches < 1)
+		return NULL;
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+	for (i = 0; i < 2 * nCaches; i++) {
+		cache = &dev->srCache[dev->srClockHand];
+		if (++dev->srClockHand >= nCaches)
+			dev->srClockHand = 0;
 
+		if (!cache->object)
+			return cache;
+		if (cache->locked)
+			continue;
+		if (cache->referenced) {
+			cache->referenced = 0;
+			continue;
 		}
-		return cache;
-	} else
+		if (!cache->dirty) {
+			yaffs_CacheRemove(cache);
+			dev->cacheEvictions++;
+			return cache;
+		}
+		if (!victim)
+			victim = cache;
+	}
+
+	if (!victim)
 		return NULL;
 
+	yaffs_FlushFilesChunkCache(victim->object);
+	if (victim->object)
+		return NULL;	/* could not write it out */
+
+	dev->cacheEvictions++;
+	return victim;
 }
 
 /* Find a cached chunk */
@@ -4403,38 +4448,33 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	struct ylist_head *head;
+	struct ylist_head *i;
+	yaffs_ChunkCache *cache;
+
 	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
+		head = yaffs_CacheHashHead(dev, obj, chunkId);
+		ylist_for_each(i, head) {
+			cache = ylist_entry(i, yaffs_ChunkCache, hashLink);
+			if (cache->object == obj &&
+			    cache->chunkId == chunkId) {
 				dev->cacheHits++;
 
-				return &dev->srCache[i];
+				return cache;
 			}
 		}
+		dev->cacheMisses++;
 	}
 	return NULL;
 }
 
-/* Mark the chunk for the least recently used algorithym */
+/* Mark the chunk as recently used for the CLOCK algorithm */
 static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 				int isAWrite)
 {
 
 	if (dev->param.nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
-		}
-
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
+		cache->referenced = 1;
 
 		if (isAWrite)
 			cache->dirty = 1;
@@ -4451,7 +4491,7 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_CacheRemove(cache);
 	}
 }
 
@@ -4467,7 +4507,7 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->param.nShortOpCaches; i++) {
 			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+				yaffs_CacheRemove(&dev->srCache[i]);
 		}
 	}
 }
@@ -5075,22 +5115,22 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		 * else bypass the cache.
 		 */
 		if (cache || nToCopy != dev->nDataBytesPerChunk || dev->param.inbandTags) {
-			if (dev->param.nShortOpCaches > 0) {
-
-				/* If we can't find the data in the cache, then load it up. */
-
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+			/* If we can't find the data in the cache, then load it up.
+			 * Grabbing a cache entry can fail if the victim could not
+			 * be flushed, in which case read through a temp buffer.
+			 */
+			if (!cache && dev->param.nShortOpCaches > 0) {
+				cache = yaffs_GrabChunkCache(in->myDev);
+				if (cache) {
+					yaffs_CacheInsert(dev, cache, in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
 					cache->nBytes = 0;
 				}
+			}
 
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -5208,12 +5248,11 @@ int yaffs_DoWriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(dev, 1)) {
 					cache = yaffs_GrabChunkCache(dev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_ReadChunkDataFromObject(in, chunk,
-								      cache->data);
+					if (cache) {
+						yaffs_CacheInsert(dev, cache, in, chunk);
+						yaffs_ReadChunkDataFromObject(in, chunk,
+									      cache->data);
+					}
 				} else if (cache &&
 					!cache->dirty &&
 					!yaffs_CheckSpaceForAllocation(dev, 1)) {
@@ -6516,7 +6555,6 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 #endif
 
 	if (in->lazyLoaded && in->hdrChunk > 0) {
-		in->lazyLoaded = 0;
 		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 		result = yaffs_ReadChunkWithTagsFromNAND(dev, in->hdrChunk, chunkData, &tags);
@@ -6540,6 +6578,8 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 
 #endif
 		yaffs_SetObjectName(in, oh->name);
+		/* Only now, so that lockless lookups never see a stale name */
+		in->lazyLoaded = 0;
 
 		if (in->variantType == YAFFS_OBJECT_TYPE_SYMLINK) {
 			in->variant.symLinkVariant.alias =
@@ -6579,6 +6619,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	int fileSize;
 	int isShrink;
 	int foundChunksInBlock;
+	int summaryAvailable;
 	int equivalentObjectId;
 	int alloc_failed = 0;
 
@@ -6733,6 +6774,15 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		/* A full block with a summary needs only the summary read */
+		summaryAvailable = 0;
+		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING)
+			summaryAvailable = yaffs_SummaryRead(dev, blk);
+		if (summaryAvailable)
+			dev->nSummaryScans++;
+		else
+			dev->nFullScans++;
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->param.nChunksPerBlock - 1;
@@ -6745,8 +6795,12 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->param.nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (summaryAvailable)
+				yaffs_SummaryFetch(dev, &tags, c,
+						bi->sequenceNumber);
+			else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+							chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -6802,6 +6856,17 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 				  dev->nFreeChunks++;
 
+			} else if (tags.objectId == YAFFS_OBJECTID_SUMMARY) {
+				/*
+				 * A good summary is in use until the block is
+				 * freed, anything else is just deleted.
+				 */
+				foundChunksInBlock = 1;
+				if (summaryAvailable)
+					bi->pagesInUse++;
+				else
+					dev->nFreeChunks++;
+
 			} else if (tags.chunkId > 0) {
 				/* chunkId > 0 so it is a data chunk... */
 				unsigned int endpos;
@@ -7165,9 +7230,10 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 
 		bi->blockState = state;
+		bi->hasSummary = summaryAvailable;
 
 		/* Now let's see if it was dirty */
-		if (bi->pagesInUse == 0 &&
+		if (bi->pagesInUse == yaffs_SummaryChunksInUse(dev, bi) &&
 		    !bi->hasShrinkHeader &&
 		    bi->blockState == YAFFS_BLOCK_STATE_FULL) {
 			yaffs_BlockBecameDirty(dev, blk);
@@ -7353,8 +7419,10 @@ static void yaffs_RemoveObjectFromDirectory(yaffs_Object *obj)
 		dev->param.removeObjectCallback(obj);
 
 
+	yaffs_NameChange(obj->myDev, 0);
 	ylist_del_init(&obj->siblings);
 	obj->parent = NULL;
+	yaffs_NameChange(obj->myDev, 1);
 	
 	yaffs_VerifyDirectory(parent);
 }
@@ -7390,8 +7458,10 @@ static void yaffs_AddObjectToDirectory(yaffs_Object *directory,
 
 
 	/* Now add it */
+	yaffs_NameChange(obj->myDev, 0);
 	ylist_add(&obj->siblings, &directory->variant.directoryVariant.children);
 	obj->parent = directory;
+	yaffs_NameChange(obj->myDev, 1);
 
 	if (directory == obj->myDev->unlinkedDir
 			|| directory == obj->myDev->deletedDir) {
@@ -7935,6 +8005,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->passiveGCs = 0;
 	dev->oldestDirtyGCs = 0;
 	dev->backgroundGCs = 0;
+	dev->foregroundGCs = 0;
+	dev->foregroundGCCopies = 0;
+	dev->gcStalls = 0;
 	dev->gcBlockFinder = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
@@ -7958,6 +8031,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->summaryTags = NULL;
+	dev->srCacheHash = NULL;
+	dev->srCacheFlushList = NULL;
 	dev->gcCleanupList = NULL;
 
 
@@ -7965,31 +8041,48 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	    dev->param.nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
+		int nBuckets = 1;
 
 		if (dev->param.nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
+		while (nBuckets < dev->param.nShortOpCaches)
+			nBuckets <<= 1;
+
 		dev->srCache =  YMALLOC(srCacheBytes);
+		dev->srCacheHash = YMALLOC(nBuckets * sizeof(struct ylist_head));
+		dev->srCacheFlushList = YMALLOC(dev->param.nShortOpCaches *
+						sizeof(yaffs_ChunkCache *));
+		dev->srCacheHashMask = nBuckets - 1;
+		dev->srClockHand = 0;
 
 		buf = (__u8 *) dev->srCache;
+		if (!dev->srCacheHash || !dev->srCacheFlushList)
+			buf = NULL;
 
-		if (dev->srCache)
+		if (buf) {
 			memset(dev->srCache, 0, srCacheBytes);
+			for (i = 0; i < nBuckets; i++)
+				YINIT_LIST_HEAD(&dev->srCacheHash[i]);
+		}
 
 		for (i = 0; i < dev->param.nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
+			dev->srCache[i].referenced = 0;
 			dev->srCache[i].dirty = 0;
+			YINIT_LIST_HEAD(&dev->srCache[i].hashLink);
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->param.totalBytesPerChunk);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
+	dev->cacheEvictions = 0;
+	dev->cacheWritebacks = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->param.nChunksPerBlock * sizeof(__u32));
@@ -7997,6 +8090,11 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 			init_failed = 1;
 	}
 
+	dev->nSummaryScans = 0;
+	dev->nFullScans = 0;
+	if (!init_failed && !yaffs_SummaryInit(dev))
+		init_failed = 1;
+
 	if (dev->param.isYaffs2)
 		dev->param.useHeaderFileSize = 1;
 
@@ -8107,9 +8205,19 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			YFREE(dev->srCache);
 			dev->srCache = NULL;
 		}
+		if (dev->srCacheHash) {
+			YFREE(dev->srCacheHash);
+			dev->srCacheHash = NULL;
+		}
+		if (dev->srCacheFlushList) {
+			YFREE(dev->srCacheFlushList);
+			dev->srCacheFlushList = NULL;
+		}
 
 		YFREE(dev->gcCleanupList);
 
+		yaffs_SummaryDeinit(dev);
+
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			YFREE(dev->tempBuffer[i].buffer);
 
@@ -86,8 +86,11 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
+/* Pseudo object id for block summary chunks */
+#define YAFFS_OBJECTID_SUMMARY		0x10
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+
+#define YAFFS_MAX_SHORT_OP_CACHES	1024
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -111,10 +114,18 @@
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
 /* ChunkCache is used for short read/write operations.*/
+/* Packed tags of one chunk, as kept in a block summary */
+typedef struct {
+	__u32 objectId;
+	__u32 chunkId;
+	__u32 byteCount;
+} yaffs_SummaryTags;
+
 typedef struct {
+	struct ylist_head hashLink;	/* In the device's cache hash */
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
+	int referenced;		/* Used since the clock hand last passed */
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -288,6 +299,7 @@ typedef struct {
 
 #ifdef CONFIG_YAFFS_YAFFS2
 	__u32 hasShrinkHeader:1; /* This block has at least one shrink object header */
+	__u32 hasSummary:1;	 /* pagesInUse includes the block's summary chunks */
 	__u32 sequenceNumber;	 /* block sequence number for yaffs2 */
 #endif
 
@@ -602,6 +614,13 @@ struct yaffs_DeviceParamStruct {
 	/*  Callback to control garbage collection. */
 	unsigned (*gcControl)(struct yaffs_DeviceStruct *dev);
 
+	/* The nameChangeCallback function brackets every change to the
+	 * children of a directory and to object names: done is 0 before the
+	 * change and 1 after it. Linux uses it to look names up without
+	 * holding its lock.
+	 */
+	void (*nameChangeCallback)(struct yaffs_DeviceStruct *dev, int done);
+
         /* Debug control flags. Don't use unless you know what you're doing */
 	int useHeaderFileSize;	/* Flag to determine if we should use file sizes from the header */
 	int disableLazyLoad;	/* Disable lazy loading on this device */
@@ -609,6 +628,8 @@ struct yaffs_DeviceParamStruct {
 	int disableSoftDelete;  /* yaffs 1 only: Set to disable the use of softdeletion. */
 	
 	int deferDirectoryUpdate; /* Set to defer directory updates */
+
+	int enableSummary;	/* yaffs2 only: Set to write block summaries */
 	
 };
 
@@ -728,7 +749,10 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	struct ylist_head *srCacheHash;
+	__u32 srCacheHashMask;
+	yaffs_ChunkCache **srCacheFlushList;
+	int srClockHand;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -750,6 +774,13 @@ struct yaffs_DeviceStruct {
 	unsigned oldestDirtySequence;
 	unsigned oldestDirtyBlock;
 
+	/* Block summaries (yaffs2) */
+	int chunksPerSummary;	/* Data chunks in a summarised block, 0 if none */
+	int summaryChunks;	/* Chunks the summary takes, 0 if none */
+	int summaryBlock;	/* Block summaryTags is being filled for, or -1 */
+	int summaryNextChunk;	/* Next chunk expected in summaryBlock */
+	yaffs_SummaryTags *summaryTags;
+
 	/* Block refreshing */
 	int refreshSkip;	/* A skip down counter. Refresh happens when this gets to zero. */
 
@@ -767,6 +798,9 @@ struct yaffs_DeviceStruct {
 	__u32 passiveGCs;
 	__u32 oldestDirtyGCs;
 	__u32 backgroundGCs;
+	__u32 foregroundGCs;	/* gc passes run from the write path */
+	__u32 foregroundGCCopies; /* chunks copied by those passes */
+	__u32 gcStalls;		/* aggressive gc a writer had to wait for */
 	__u32 nRetriedWrites;
 	__u32 nRetiredBlocks;
 	__u32 eccFixed;
@@ -777,6 +811,11 @@ struct yaffs_DeviceStruct {
 	__u32 nUnmarkedDeletions;
 	__u32 refreshCount;
 	__u32 cacheHits;
+	__u32 cacheMisses;
+	__u32 cacheEvictions;
+	__u32 cacheWritebacks;
+	__u32 nSummaryScans;	/* Blocks scanned from their summary */
+	__u32 nFullScans;	/* Blocks scanned chunk by chunk */
 
 };
 
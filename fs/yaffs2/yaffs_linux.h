@@ -16,6 +16,9 @@
 #ifndef __YAFFS_LINUX_H__
 #define __YAFFS_LINUX_H__
 
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+
 #include "devextras.h"
 #include "yportenv.h"
 
@@ -25,15 +28,16 @@ struct yaffs_LinuxContext {
 	struct super_block * superBlock;
 	struct task_struct *bgThread; /* Background thread for this device */
 	int bgRunning;
-        struct semaphore grossLock;     /* Gross locking semaphore */
+	unsigned long lastWrite;	/* jiffies of the last foreground write */
+	int bgKicked;		/* Urgent gc wanted before the next timeout */
+	struct mutex grossLock;		/* Gross locking mutex */
+	seqcount_t nameSeq;		/* Bumped around directory changes */
 	__u8 *spareBuffer;      /* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
 	struct mtd_info *mtd;
 	struct ylist_head searchContexts;
 	void (*putSuperFunc)(struct super_block *sb);
-
-	struct task_struct *readdirProcess;
 };
 
 #define yaffs_DeviceToContext(dev) ((struct yaffs_LinuxContext *)((dev)->context))
@@ -0,0 +1,310 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block summaries.
+ *
+ * The tags of every data chunk in a block are gathered as the block is
+ * filled and written out into the last chunk(s) of the block once the
+ * data chunks are used up. A backwards scan can then pick up a full
+ * block's tags from one read instead of reading every chunk.
+ *
+ * The summary chunks are never entered in the chunk bitmap, so gc never
+ * copies them, but once written they are counted in the block's
+ * pagesInUse (and taken off nFreeChunks) while the block holds live
+ * data. That keeps a full, summarised block from looking dirty. They
+ * are given back when the last data chunk goes and the block is freed.
+ *
+ * A block only gets a summary if all of its data chunks were written in
+ * order by this mount. Anything else (a block resumed after a remount,
+ * a skipped chunk, a failed write) leaves the block without one and the
+ * scan falls back to reading the tags chunk by chunk.
+ */
+
+#include "yaffs_summary.h"
+#include "yaffs_packedtags2.h"
+#include "yaffs_tagsvalidity.h"
+#include "yaffs_nand.h"
+#include "yaffs_getblockinfo.h"
+
+#define YAFFS_SUMMARY_VERSION	1
+
+typedef struct {
+	__u32 version;
+	__u32 block;
+	__u32 sequenceNumber;
+	__u32 sum;
+} yaffs_SummaryHeader;
+
+static int yaffs_SummaryBytesPerChunk(yaffs_Device *dev)
+{
+	return dev->nDataBytesPerChunk - sizeof(yaffs_SummaryHeader);
+}
+
+static __u32 yaffs_SummarySum(yaffs_Device *dev)
+{
+	__u8 *p = (__u8 *)dev->summaryTags;
+	int n = dev->chunksPerSummary * sizeof(yaffs_SummaryTags);
+	__u32 sum = 0;
+
+	while (n-- > 0)
+		sum = ((sum << 1) | (sum >> 31)) + *p++;
+
+	return sum;
+}
+
+int yaffs_SummaryInit(yaffs_Device *dev)
+{
+	int nChunks = 1;
+	int perChunk = yaffs_SummaryBytesPerChunk(dev);
+	int cpb = dev->param.nChunksPerBlock;
+
+	dev->chunksPerSummary = 0;
+	dev->summaryChunks = 0;
+	dev->summaryBlock = -1;
+	dev->summaryNextChunk = 0;
+	dev->summaryTags = NULL;
+
+	if (!dev->param.isYaffs2)
+		return YAFFS_OK;
+
+	/* Smallest number of chunks that can hold the tags of the rest */
+	while (nChunks < cpb &&
+		(cpb - nChunks) * sizeof(yaffs_SummaryTags) > nChunks * perChunk)
+		nChunks++;
+
+	/* Not worth it if it eats a big part of the block */
+	if (nChunks * 4 > cpb)
+		return YAFFS_OK;
+
+	/*
+	 * Set up even when summaries are not written: the scan still uses
+	 * those already on the medium, and a checkpoint may have blocks
+	 * with their summary counted in use.
+	 */
+	dev->summaryTags = YMALLOC((cpb - nChunks) * sizeof(yaffs_SummaryTags));
+	if (!dev->summaryTags)
+		return YAFFS_FAIL;
+
+	dev->chunksPerSummary = cpb - nChunks;
+	dev->summaryChunks = nChunks;
+
+	T(YAFFS_TRACE_SCAN,
+	  (TSTR("yaffs: block summary uses %d of %d chunks" TENDSTR),
+	   nChunks, cpb));
+
+	return YAFFS_OK;
+}
+
+void yaffs_SummaryDeinit(yaffs_Device *dev)
+{
+	if (dev->summaryTags)
+		YFREE(dev->summaryTags);
+	dev->summaryTags = NULL;
+	dev->chunksPerSummary = 0;
+	dev->summaryChunks = 0;
+}
+
+static int yaffs_SummaryWrite(yaffs_Device *dev, int blk)
+{
+	yaffs_ExtendedTags tags;
+	yaffs_SummaryHeader hdr;
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blk);
+	__u8 *buffer;
+	__u8 *src = (__u8 *)dev->summaryTags;
+	int nBytes = dev->chunksPerSummary * sizeof(yaffs_SummaryTags);
+	int perChunk = yaffs_SummaryBytesPerChunk(dev);
+	int chunk = blk * dev->param.nChunksPerBlock + dev->chunksPerSummary;
+	int result = YAFFS_OK;
+	int thisChunk;
+	int i;
+
+	hdr.version = YAFFS_SUMMARY_VERSION;
+	hdr.block = blk;
+	hdr.sequenceNumber = bi->sequenceNumber;
+	hdr.sum = yaffs_SummarySum(dev);
+
+	buffer = yaffs_GetTempBuffer(dev, __LINE__);
+
+	/* Always fill every summary chunk so the block reads back as full */
+	for (i = 0; i < dev->summaryChunks && result == YAFFS_OK; i++) {
+		thisChunk = (nBytes > perChunk) ? perChunk : nBytes;
+
+		memset(buffer, 0xff, dev->nDataBytesPerChunk);
+		memcpy(buffer, &hdr, sizeof(hdr));
+		memcpy(buffer + sizeof(hdr), src, thisChunk);
+
+		yaffs_InitialiseTags(&tags);
+		tags.objectId = YAFFS_OBJECTID_SUMMARY;
+		tags.chunkId = i + 1;
+		tags.byteCount = sizeof(hdr) + thisChunk;
+
+		result = yaffs_WriteChunkWithTagsToNAND(dev, chunk + i,
+							buffer, &tags);
+		src += thisChunk;
+		nBytes -= thisChunk;
+	}
+
+	yaffs_ReleaseTempBuffer(dev, buffer, __LINE__);
+
+	if (result != YAFFS_OK) {
+		/* Something is up with this block, get it collected soon */
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs: failed writing summary for block %d" TENDSTR),
+		   blk));
+		bi->gcPrioritise = 1;
+		dev->hasPendingPrioritisedGCs = 1;
+	}
+
+	return result;
+}
+
+/*
+ * Record the tags of a chunk that has just been written.
+ * When the last data chunk of the block goes in, the summary is written
+ * and the allocator moves on to the next block.
+ */
+void yaffs_SummaryAdd(yaffs_Device *dev, yaffs_ExtendedTags *tags,
+			int chunkInNAND)
+{
+	yaffs_PackedTags2TagsPart pt;
+	yaffs_SummaryTags *st;
+	yaffs_BlockInfo *bi;
+	int blk = chunkInNAND / dev->param.nChunksPerBlock;
+	int c = chunkInNAND % dev->param.nChunksPerBlock;
+
+	if (!dev->chunksPerSummary || !dev->param.enableSummary)
+		return;
+
+	if (c == 0) {
+		memset(dev->summaryTags, 0,
+			dev->chunksPerSummary * sizeof(yaffs_SummaryTags));
+		dev->summaryBlock = blk;
+		dev->summaryNextChunk = 0;
+	}
+
+	if (blk != dev->summaryBlock || c != dev->summaryNextChunk ||
+		c >= dev->chunksPerSummary) {
+		/* Not filling this block in order, no summary for it */
+		dev->summaryBlock = -1;
+		return;
+	}
+
+	yaffs_PackTags2TagsPart(&pt, tags);
+	st = &dev->summaryTags[c];
+	st->objectId = pt.objectId;
+	st->chunkId = pt.chunkId;
+	st->byteCount = pt.byteCount;
+	dev->summaryNextChunk++;
+
+	if (c < dev->chunksPerSummary - 1)
+		return;
+
+	bi = yaffs_GetBlockInfo(dev, blk);
+	if (yaffs_SummaryWrite(dev, blk) == YAFFS_OK) {
+		bi->hasSummary = 1;
+		bi->pagesInUse += dev->summaryChunks;
+		dev->nFreeChunks -= dev->summaryChunks;
+	}
+	dev->summaryBlock = -1;
+
+	/* The rest of the block belongs to the summary */
+	if (dev->allocationBlock == blk &&
+		bi->blockState == YAFFS_BLOCK_STATE_ALLOCATING) {
+		bi->blockState = YAFFS_BLOCK_STATE_FULL;
+		dev->allocationBlock = -1;
+	}
+}
+
+/*
+ * Read the summary of a block into dev->summaryTags.
+ * Returns 1 if the block has a good summary.
+ */
+int yaffs_SummaryRead(yaffs_Device *dev, int blk)
+{
+	yaffs_ExtendedTags tags;
+	yaffs_SummaryHeader hdr;
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blk);
+	__u8 *buffer;
+	__u8 *dst = (__u8 *)dev->summaryTags;
+	int nBytes = dev->chunksPerSummary * sizeof(yaffs_SummaryTags);
+	int perChunk = yaffs_SummaryBytesPerChunk(dev);
+	int chunk = blk * dev->param.nChunksPerBlock + dev->chunksPerSummary;
+	int thisChunk;
+	__u32 sum = 0;
+	int ok = 1;
+	int i;
+
+	if (!dev->chunksPerSummary)
+		return 0;
+
+	buffer = yaffs_GetTempBuffer(dev, __LINE__);
+
+	for (i = 0; i < dev->summaryChunks && ok; i++) {
+		yaffs_ReadChunkWithTagsFromNAND(dev, chunk + i, buffer, &tags);
+
+		if (!tags.chunkUsed ||
+			tags.eccResult == YAFFS_ECC_RESULT_UNFIXED ||
+			tags.objectId != YAFFS_OBJECTID_SUMMARY ||
+			tags.chunkId != i + 1) {
+			ok = 0;
+			break;
+		}
+
+		memcpy(&hdr, buffer, sizeof(hdr));
+		if (hdr.version != YAFFS_SUMMARY_VERSION ||
+			hdr.block != blk ||
+			hdr.sequenceNumber != bi->sequenceNumber) {
+			ok = 0;
+			break;
+		}
+		if (i == 0)
+			sum = hdr.sum;
+
+		thisChunk = (nBytes > perChunk) ? perChunk : nBytes;
+		memcpy(dst, buffer + sizeof(hdr), thisChunk);
+		dst += thisChunk;
+		nBytes -= thisChunk;
+	}
+
+	yaffs_ReleaseTempBuffer(dev, buffer, __LINE__);
+
+	if (ok && yaffs_SummarySum(dev) != sum)
+		ok = 0;
+
+	/* The buffer no longer matches the allocation block, if any */
+	dev->summaryBlock = -1;
+
+	return ok;
+}
+
+/*
+ * Make up the tags for a chunk of a block whose summary has been read.
+ * The summary chunks themselves come back with their own object id.
+ */
+void yaffs_SummaryFetch(yaffs_Device *dev, yaffs_ExtendedTags *tags,
+			int chunkInBlock, unsigned sequenceNumber)
+{
+	yaffs_PackedTags2TagsPart pt;
+	yaffs_SummaryTags *st;
+
+	pt.sequenceNumber = sequenceNumber;
+
+	if (chunkInBlock >= dev->chunksPerSummary) {
+		pt.objectId = YAFFS_OBJECTID_SUMMARY;
+		pt.chunkId = chunkInBlock - dev->chunksPerSummary + 1;
+		pt.byteCount = 0;
+	} else {
+		st = &dev->summaryTags[chunkInBlock];
+		pt.objectId = st->objectId;
+		pt.chunkId = st->chunkId;
+		pt.byteCount = st->byteCount;
+	}
+
+	yaffs_UnpackTags2TagsPart(tags, &pt);
+}
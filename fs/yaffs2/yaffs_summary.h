@@ -0,0 +1,34 @@
+/*
+ * YAFFS: Yet another Flash File System . A NAND-flash specific file system.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1 as
+ * published by the Free Software Foundation.
+ *
+ * Note: Only YAFFS headers are LGPL, YAFFS C code is covered by GPL.
+ */
+
+#ifndef __YAFFS_SUMMARY_H__
+#define __YAFFS_SUMMARY_H__
+
+#include "yaffs_guts.h"
+
+int yaffs_SummaryInit(yaffs_Device *dev);
+
+void yaffs_SummaryDeinit(yaffs_Device *dev);
+
+void yaffs_SummaryAdd(yaffs_Device *dev, yaffs_ExtendedTags *tags,
+			int chunkInNAND);
+
+int yaffs_SummaryRead(yaffs_Device *dev, int blk);
+
+void yaffs_SummaryFetch(yaffs_Device *dev, yaffs_ExtendedTags *tags,
+			int chunkInBlock, unsigned sequenceNumber);
+
+static Y_INLINE int yaffs_SummaryChunksInUse(yaffs_Device *dev,
+					yaffs_BlockInfo *bi)
+{
+	return bi->hasSummary ? dev->summaryChunks : 0;
+}
+
+#endif
@@ -1,7 +1,13 @@
 #ifndef BLK_IOPOLL_H
 #define BLK_IOPOLL_H
 
+#include <linux/bio.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
 struct blk_iopoll;
+struct request;
+struct request_queue;
 typedef int (blk_iopoll_fn)(struct blk_iopoll *, int);
 
 struct blk_iopoll {
@@ -44,5 +50,29 @@ extern void blk_iopoll_enable(struct blk_iopoll *);
 extern void blk_iopoll_disable(struct blk_iopoll *);
 
 extern int blk_iopoll_enabled;
+extern int blk_iopoll_budget;
+
+/*
+ * Completion batching for drivers that learn about finished I/O in
+ * interrupt context. Finished requests or bios are handed to the cq and
+ * ended in batches of up to @weight from the iopoll softirq, taking the
+ * queue lock once per batch. Completions handed in from process context
+ * are ended inline.
+ */
+struct blk_iopoll_cq {
+	struct blk_iopoll iop;
+	spinlock_t lock;
+	struct request_queue *q;
+	struct list_head rq_list;
+	struct bio_list bio_list;
+};
+
+extern void blk_iopoll_cq_init(struct blk_iopoll_cq *, struct request_queue *,
+			       int);
+extern void blk_iopoll_cq_drain(struct blk_iopoll_cq *);
+extern void blk_iopoll_cq_destroy(struct blk_iopoll_cq *);
+extern void blk_iopoll_end_request(struct blk_iopoll_cq *, struct request *,
+				   int);
+extern void blk_iopoll_bio_endio(struct blk_iopoll_cq *, struct bio *, int);
 
 #endif
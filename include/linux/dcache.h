@@ -94,9 +94,10 @@ struct dentry {
 	struct inode *d_inode;		/* Where the name belongs to - NULL is
 					 * negative */
 	/*
-	 * The next three fields are touched by __d_lookup.  Place them here
+	 * The next four fields are touched by __d_lookup.  Place them here
 	 * so they all fit in a cache line.
 	 */
+	seqcount_t d_seq;		/* per dentry seqlock, for RCU walk */
 	struct hlist_node d_hash;	/* lookup hash list */
 	struct dentry *d_parent;	/* parent directory */
 	struct qstr d_name;
@@ -212,6 +213,7 @@ static inline void __d_drop(struct dentry *dentry)
 	if (!(dentry->d_flags & DCACHE_UNHASHED)) {
 		dentry->d_flags |= DCACHE_UNHASHED;
 		hlist_del_rcu(&dentry->d_hash);
+		write_seqcount_barrier(&dentry->d_seq);
 	}
 }
 
@@ -303,6 +305,8 @@ extern struct dentry *d_ancestor(struct dentry *, struct dentry *);
 /* appendix may either be NULL or be used for transname suffixes */
 extern struct dentry * d_lookup(struct dentry *, struct qstr *);
 extern struct dentry * __d_lookup(struct dentry *, struct qstr *);
+extern struct dentry *__d_lookup_rcu(struct dentry *, struct qstr *,
+				     unsigned *);
 extern struct dentry * d_hash_and_lookup(struct dentry *, struct qstr *);
 
 /* validate "insecure" dentry pointer */
@@ -344,6 +348,7 @@ static inline struct dentry *dget(struct dentry *dentry)
 }
 
 extern struct dentry * dget_locked(struct dentry *);
+extern int d_rcu_to_refcount(struct dentry *, unsigned);
 
 /**
  *	d_unhashed -	is dentry hashed
@@ -47,6 +47,7 @@
 #define _LINUX_FUSE_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /*
  * Version negotiation:
@@ -600,4 +601,14 @@ struct fuse_notify_retrieve_in {
 	__u64	dummy4;
 };
 
+/*
+ * Device ioctls
+ *
+ * FUSE_DEV_IOC_CLONE: called on a freshly opened /dev/fuse with a
+ * pointer to the fd of an already mounted one.  The new fd is bound to
+ * the same connection, reading from a request queue of its own where
+ * there is a CPU to spare.
+ */
+#define FUSE_DEV_IOC_CLONE	_IOR(229, 0, __u32)
+
 #endif /* _LINUX_FUSE_H */
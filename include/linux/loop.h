@@ -16,6 +16,7 @@
 #ifdef __KERNEL__
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-iopoll.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
@@ -61,6 +62,8 @@ struct loop_device {
 	struct mutex		lo_ctl_mutex;
 	struct task_struct	*lo_thread;
 	wait_queue_head_t	lo_event;
+	struct blk_iopoll_cq	lo_cq;		/* batched bio completion */
+	atomic_t		lo_dio_inflight; /* LO_FLAGS_DIRECT_IO bios */
 
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
@@ -76,6 +79,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
 	LO_FLAGS_AUTOCLEAR	= 4,
+	LO_FLAGS_DIRECT_IO	= 16,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
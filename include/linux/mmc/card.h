@@ -54,6 +54,7 @@ struct mmc_ext_csd {
 	unsigned int		sec_trim_mult;	/* Secure trim multiplier  */
 	unsigned int		sec_erase_mult;	/* Secure erase multiplier */
 	unsigned int		trim_timeout;		/* In milliseconds */
+	unsigned int		max_packed_writes;	/* 0 if unsupported */
 };
 
 struct sd_scr {
@@ -260,6 +261,11 @@ static inline int mmc_blksz_for_byte_mode(const struct mmc_card *c)
 	return c->quirks & MMC_QUIRK_BLKSZ_FOR_BYTE_MODE;
 }
 
+/* Both the host and the card (eMMC 4.5) must support packed writes */
+#define mmc_card_packed_wr(c)	\
+	(((c)->host->caps & MMC_CAP_PACKED_WR) && \
+	 (c)->ext_csd.max_packed_writes > 1)
+
 #define mmc_card_name(c)	((c)->cid.prod_name)
 #define mmc_card_id(c)		(dev_name(&(c)->dev))
 
@@ -82,6 +82,19 @@ struct mmc_host_ops {
 	 */
 	int (*enable)(struct mmc_host *host);
 	int (*disable)(struct mmc_host *host, int lazy);
+	/*
+	 * It is optional for the host to implement pre_req and post_req in
+	 * order to support double buffering of requests (prepare one
+	 * request while another request is active).  pre_req() is called
+	 * before request() and may run while a previous request is still
+	 * on the bus; is_first_req is set when nothing is in flight.
+	 * post_req() is called once the request has completed, with a
+	 * non-zero err when it was never started or must be undone.
+	 */
+	void	(*post_req)(struct mmc_host *host, struct mmc_request *req,
+			    int err);
+	void	(*pre_req)(struct mmc_host *host, struct mmc_request *req,
+			   bool is_first_req);
 	void	(*request)(struct mmc_host *host, struct mmc_request *req);
 	/*
 	 * Avoid calling these three functions too often or in a "fast path",
@@ -158,6 +171,7 @@ struct mmc_host {
 #define MMC_CAP_WAIT_WHILE_BUSY	(1 << 9)	/* Waits while card is busy */
 #define MMC_CAP_ERASE		(1 << 10)	/* Allow erase/trim commands */
 #define MMC_CAP_FORCE_HS	(1 << 11)	/* Must enable highspeed mode */
+#define MMC_CAP_PACKED_WR	(1 << 12)	/* Allow packed write commands */
 
 	mmc_pm_flag_t		pm_caps;	/* supported pm features */
 
@@ -200,6 +214,12 @@ struct mmc_host {
 
 	struct delayed_work	detect;
 
+	struct mmc_async_req	*areq;		/* active async req */
+
+	/* Data accounting, for hosts that keep it */
+	u64			bytes_direct;	/* DMA to/from request pages */
+	u64			bytes_bounced;	/* copied by the CPU on the way */
+
 	const struct mmc_bus_ops *bus_ops;	/* current bus driver */
 	unsigned int		bus_refs;	/* reference counter */
 
@@ -267,6 +267,8 @@ struct _mmc_csd {
 #define EXT_CSD_SEC_ERASE_MULT		230	/* RO */
 #define EXT_CSD_SEC_FEATURE_SUPPORT	231	/* RO */
 #define EXT_CSD_TRIM_MULT		232	/* RO */
+#define EXT_CSD_MAX_PACKED_WRITES	500	/* RO */
+#define EXT_CSD_MAX_PACKED_READS	501	/* RO */
 
 /*
  * EXT_CSD field definitions
@@ -288,6 +290,17 @@ struct _mmc_csd {
 #define EXT_CSD_SEC_BD_BLK_EN	BIT(2)
 #define EXT_CSD_SEC_GB_CL_EN	BIT(4)
 
+/*
+ * Packed commands (CMD23 argument and packed command header)
+ */
+
+#define MMC_CMD23_ARG_PACKED	(1 << 30)
+
+#define MMC_PACKED_HDR_SIZE	512	/* Header is one 512 byte block */
+#define MMC_PACKED_MAX_ENTRIES	(MMC_PACKED_HDR_SIZE / 8 - 1)
+#define MMC_PACKED_VERSION	0x01
+#define MMC_PACKED_WRITE	0x02
+
 /*
  * MMC_SWITCH access modes
  */
@@ -175,8 +175,15 @@ struct per_cpu_pages {
 	struct list_head lists[MIGRATE_PCPTYPES];
 };
 
+/*
+ * Besides order-0 pages, the per-cpu lists also keep blocks of orders
+ * 1..PCP_MAX_ORDER, which are used for kernel stacks and page tables.
+ */
+#define PCP_MAX_ORDER	2
+
 struct per_cpu_pageset {
 	struct per_cpu_pages pcp;
+	struct per_cpu_pages pcp_order[PCP_MAX_ORDER];	/* orders 1.. */
 #ifdef CONFIG_NUMA
 	s8 expire;
 #endif
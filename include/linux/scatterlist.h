@@ -150,7 +150,7 @@ static inline void sg_chain(struct scatterlist *prv, unsigned int prv_nents,
 
 /**
  * sg_mark_end - Mark the end of the scatterlist
- * @sg:		 SG entryScatterlist
+ * @sg:		 SG entry
  *
  * Description:
  *   Marks the passed in sg entry as the termination point for the sg
@@ -169,6 +169,23 @@ static inline void sg_mark_end(struct scatterlist *sg)
 	sg->page_link &= ~0x01;
 }
 
+/**
+ * sg_unmark_end - Undo setting the end of the scatterlist
+ * @sg:		 SG entry
+ *
+ * Description:
+ *   Removes the termination marker from the given entry of the scatterlist,
+ *   so that a table can be built from several partial mappings.
+ *
+ **/
+static inline void sg_unmark_end(struct scatterlist *sg)
+{
+#ifdef CONFIG_DEBUG_SG
+	BUG_ON(sg->sg_magic != SG_MAGIC);
+#endif
+	sg->page_link &= ~0x02;
+}
+
 /**
  * sg_phys - Return physical address of an sg entry
  * @sg:	     SG entry
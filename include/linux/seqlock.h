@@ -167,6 +167,19 @@ static inline void write_seqcount_end(seqcount_t *s)
 	s->sequence++;
 }
 
+/*
+ * write_seqcount_barrier - invalidate in-progress read-side seq operations
+ *
+ * After write_seqcount_barrier, no read-side seq operations will complete
+ * successfully and see data older than this.  The count stays even, so
+ * it may be nested inside a write_seqcount_begin/end section.
+ */
+static inline void write_seqcount_barrier(seqcount_t *s)
+{
+	smp_wmb();
+	s->sequence += 2;
+}
+
 /*
  * Possible sw/hw IRQ protected versions of the interfaces.
  */
@@ -85,7 +85,7 @@ struct kmem_cache {
 	struct list_head next;
 
 /* 6) statistics */
-#ifdef CONFIG_DEBUG_SLAB
+#if defined(CONFIG_DEBUG_SLAB) || defined(CONFIG_SLAB_STATS)
 	unsigned long num_active;
 	unsigned long num_allocations;
 	unsigned long high_mark;
@@ -100,7 +100,13 @@ struct kmem_cache {
 	atomic_t allocmiss;
 	atomic_t freehit;
 	atomic_t freemiss;
+	atomic_t allocswap;
+	atomic_t freeswap;
+	unsigned long refills;
+	unsigned long long refill_ns;
+#endif
 
+#ifdef CONFIG_DEBUG_SLAB
 	/*
 	 * If debugging is enabled, then the allocator can add additional
 	 * fields and/or padding to every object. buffer_size contains the total
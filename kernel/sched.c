@@ -3921,6 +3921,14 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	/*
+	 * If we are going to sleep with requests held in a plug, submit
+	 * them first: what we are waiting for may depend on them.
+	 */
+	if (current->state && !(preempt_count() & PREEMPT_ACTIVE) &&
+	    blk_needs_flush_plug(current))
+		blk_schedule_flush_plug(current);
+
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -578,6 +578,16 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/*
+ * Return the per-cpu list for blocks of the given order, which must not
+ * be above PCP_MAX_ORDER.
+ */
+static inline struct per_cpu_pages *pset_pcp(struct per_cpu_pageset *pset,
+					     unsigned int order)
+{
+	return order ? &pset->pcp_order[order - 1] : &pset->pcp;
+}
+
 /*
  * Frees a number of pages from the PCP lists
  * Assumes all pages on list are in same zone, and of same order.
@@ -590,7 +600,7 @@ static inline int free_pages_check(struct page *page)
  * pinned" detection logic.
  */
 static void free_pcppages_bulk(struct zone *zone, int count,
-					struct per_cpu_pages *pcp)
+				struct per_cpu_pages *pcp, unsigned int order)
 {
 	int migratetype = 0;
 	int batch_free = 0;
@@ -623,11 +633,11 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
 		} while (--to_free && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, count << order);
 	spin_unlock(&zone->lock);
 }
 
@@ -672,11 +682,19 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
+static void __free_pcp_page(struct page *page, unsigned int order, int cold);
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
+
+	if (order <= PCP_MAX_ORDER) {
+		__free_pcp_page(page, order, 0);
+		return;
+	}
 
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -1069,7 +1087,7 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 		to_drain = pcp->batch;
 	else
 		to_drain = pcp->count;
-	free_pcppages_bulk(zone, to_drain, pcp);
+	free_pcppages_bulk(zone, to_drain, pcp, 0);
 	pcp->count -= to_drain;
 	local_irq_restore(flags);
 }
@@ -1090,14 +1108,17 @@ static void drain_pages(unsigned int cpu)
 	for_each_populated_zone(zone) {
 		struct per_cpu_pageset *pset;
 		struct per_cpu_pages *pcp;
+		unsigned int order;
 
 		local_irq_save(flags);
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
-		pcp = &pset->pcp;
-		if (pcp->count) {
-			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
+		for (order = 0; order <= PCP_MAX_ORDER; order++) {
+			pcp = pset_pcp(pset, order);
+			if (pcp->count) {
+				free_pcppages_bulk(zone, pcp->count, pcp, order);
+				pcp->count = 0;
+			}
 		}
 		local_irq_restore(flags);
 	}
@@ -1156,10 +1177,10 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a block of order up to PCP_MAX_ORDER to the per-cpu lists
  * cold == 1 ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void __free_pcp_page(struct page *page, unsigned int order, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
@@ -1167,15 +1188,20 @@ void free_hot_cold_page(struct page *page, int cold)
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
-	if (!free_pages_prepare(page, 0))
+	if (!free_pages_prepare(page, order))
 		return;
 
+	/* The per-cpu lists only hold plain blocks */
+	if (order && PageCompound(page))
+		if (unlikely(destroy_compound_page(page, order)))
+			return;
+
 	migratetype = get_pageblock_migratetype(page);
 	set_page_private(page, migratetype);
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1186,20 +1212,20 @@ void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
-	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	pcp = pset_pcp(this_cpu_ptr(zone->pageset), order);
 	if (cold)
 		list_add_tail(&page->lru, &pcp->lists[migratetype]);
 	else
 		list_add(&page->lru, &pcp->lists[migratetype]);
 	pcp->count++;
 	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
+		free_pcppages_bulk(zone, pcp->batch, pcp, order);
 		pcp->count -= pcp->batch;
 	}
 
@@ -1207,6 +1233,15 @@ out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	__free_pcp_page(page, 0, cold);
+}
+
 /*
  * split_page takes a non-compound higher-order page, and splits it into
  * n (1<<order) sub-pages: page[0..n]
@@ -1295,15 +1330,15 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	int cold = !!(gfp_flags & __GFP_COLD);
 
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PCP_MAX_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
-		pcp = &this_cpu_ptr(zone->pageset)->pcp;
+		pcp = pset_pcp(this_cpu_ptr(zone->pageset), order);
 		list = &pcp->lists[migratetype];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
+			pcp->count += rmqueue_bulk(zone, order,
 					pcp->batch, list,
 					migratetype, cold);
 			if (unlikely(list_empty(list)))
@@ -3405,6 +3440,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
+	unsigned int order;
 	int migratetype;
 
 	memset(p, 0, sizeof(*p));
@@ -3415,23 +3451,49 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->batch = max(1UL, 1 * batch);
 	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
 		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+
+	/*
+	 * Higher order lists move fewer, bigger blocks and are kept
+	 * shorter, so that they don't pin too much contiguous memory.
+	 */
+	for (order = 1; order <= PCP_MAX_ORDER; order++) {
+		unsigned long order_batch = batch >> (order + 1);
+
+		pcp = pset_pcp(p, order);
+		pcp->count = 0;
+		pcp->high = 4 * order_batch;
+		pcp->batch = max(1UL, order_batch);
+		for (migratetype = 0; migratetype < MIGRATE_PCPTYPES;
+		     migratetype++)
+			INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	}
 }
 
 /*
  * setup_pagelist_highmark() sets the high water mark for hot per_cpu_pagelist
- * to the value high for the pageset p.
+ * to the value high for the pageset p.  The higher order lists are scaled
+ * down from it like in setup_pageset().
  */
 
 static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 				unsigned long high)
 {
 	struct per_cpu_pages *pcp;
+	unsigned int order;
 
 	pcp = &p->pcp;
 	pcp->high = high;
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
 		pcp->batch = PAGE_SHIFT * 8;
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++) {
+		unsigned long order_high = (high / 6) >> (order - 1);
+
+		pcp = pset_pcp(p, order);
+		pcp->high = order_high;
+		pcp->batch = max(1UL, order_high/4);
+	}
 }
 
 static __meminit void setup_zone_pageset(struct zone *zone)
@@ -3516,12 +3578,15 @@ static int __zone_pcp_update(void *data)
 	for_each_possible_cpu(cpu) {
 		struct per_cpu_pageset *pset;
 		struct per_cpu_pages *pcp;
+		unsigned int order;
 
 		pset = per_cpu_ptr(zone->pageset, cpu);
-		pcp = &pset->pcp;
 
 		local_irq_save(flags);
-		free_pcppages_bulk(zone, pcp->count, pcp);
+		for (order = 0; order <= PCP_MAX_ORDER; order++) {
+			pcp = pset_pcp(pset, order);
+			free_pcppages_bulk(zone, pcp->count, pcp, order);
+		}
 		setup_pageset(pset, batch);
 		local_irq_restore(flags);
 	}
@@ -18,6 +18,9 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -249,6 +252,7 @@ unsigned long ra_submit(struct file_ra_state *ra,
 
 	actual = __do_page_cache_readahead(mapping, filp,
 					ra->start, ra->size, ra->async_size);
+	trace_readahead_submit(mapping, ra, actual);
 
 	return actual;
 }
@@ -291,6 +295,103 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	return min(newsize, max);
 }
 
+/*
+ * Per-file readahead efficiency.
+ *
+ * Readahead pages are counted as hits once the stream has read them: when
+ * it consumes the next PG_readahead marker, or, for the part read since,
+ * when the window is given up.  Pages of a window still unread when it is
+ * given up on a seek count as waste.  Pages that are reclaimed unread
+ * while the window is still current are not seen here.  The counts are
+ * halved once they cover RA_HISTORY maximum windows, so they follow the
+ * recent access pattern of the file.
+ */
+#define RA_HISTORY	4
+#define RA_MIN_PAGES	4
+
+static void ra_account(struct file_ra_state *ra, unsigned int hits,
+		       unsigned int waste)
+{
+	ra->hits += hits;
+	ra->waste += waste;
+	if (ra->hits + ra->waste > RA_HISTORY * ra->ra_pages) {
+		ra->hits /= 2;
+		ra->waste /= 2;
+	}
+	if (hits)
+		count_vm_events(READAHEAD_HIT, hits);
+	if (waste)
+		count_vm_events(READAHEAD_WASTED, waste);
+}
+
+/*
+ * Count the readahead pages read since the last credit, up to @index, as
+ * hits.  They may reach back into the previous window, whose trailing
+ * part is only read once the marker of the current one is reached.
+ */
+static void ra_credit(struct file_ra_state *ra, pgoff_t index)
+{
+	pgoff_t end = ra->start + ra->size;
+
+	if (!ra->size || !ra->async_size)
+		return;
+	if (index > end)
+		index = end;
+	if (index <= ra->hit_start)
+		return;
+	if (index - ra->hit_start > ra->size)
+		ra->hit_start = index - ra->size;
+	ra_account(ra, index - ra->hit_start, 0);
+	ra->hit_start = index;
+}
+
+/*
+ * Pages of the current window past the last read position.  mmap
+ * read-around windows (async_size == 0) are centered on the fault and
+ * are accounted through mmap_miss instead.
+ */
+static unsigned int ra_unused_pages(struct file_ra_state *ra)
+{
+	pgoff_t end = ra->start + ra->size;
+	pgoff_t next = (ra->prev_pos >> PAGE_CACHE_SHIFT) + 1;
+
+	if (!ra->size || !ra->async_size)
+		return 0;
+	if (next < ra->start)
+		next = ra->start;
+	if (next >= end)
+		return 0;
+	return end - next;
+}
+
+/*
+ * Give up on the current window at a seek: the pages read since the last
+ * marker were hits, the rest is waste.
+ */
+static void ra_retire(struct file_ra_state *ra)
+{
+	ra_credit(ra, (ra->prev_pos >> PAGE_CACHE_SHIFT) + 1);
+	ra_account(ra, 0, ra_unused_pages(ra));
+}
+
+/*
+ * Shrink the maximum window of a file in proportion to how much of its
+ * recent readahead was used, so that files read in scattered chunks
+ * (executables and packages being faulted in, say) stop pulling in whole
+ * windows, while streams keep the full bdi size.
+ */
+static unsigned long ra_adaptive_max(struct file_ra_state *ra,
+				     unsigned long max)
+{
+	unsigned long total = ra->hits + ra->waste;
+	unsigned long size;
+
+	if (total < max)
+		return max;
+	size = max * ra->hits / total;
+	return max_t(unsigned long, size, min_t(unsigned long, max, RA_MIN_PAGES));
+}
+
 /*
  * On-demand readahead design.
  *
@@ -376,9 +477,11 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_retire(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
+	ra->hit_start = offset + req_size;
 
 	return 1;
 }
@@ -392,7 +495,9 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long max;
+
+	max = ra_adaptive_max(ra, max_sane_readahead(ra->ra_pages));
 
 	/*
 	 * start of file
@@ -406,6 +511,7 @@ ondemand_readahead(struct address_space *mapping,
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		ra_credit(ra, offset);
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
@@ -429,6 +535,7 @@ ondemand_readahead(struct address_space *mapping,
 			return 0;
 
 		ra->start = start;
+		ra->hit_start = offset;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
 		ra->size = get_next_ra_size(ra, max);
@@ -462,9 +569,11 @@ ondemand_readahead(struct address_space *mapping,
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	ra_retire(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
+	ra->hit_start = offset + req_size;
 
 readit:
 	/*
@@ -502,6 +611,8 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	if (!ra->ra_pages)
 		return;
 
+	count_vm_event(READAHEAD_MISS);
+
 	/* be dumb */
 	if (filp && (filp->f_mode & FMODE_RANDOM)) {
 		force_page_cache_readahead(mapping, filp, offset, req_size);
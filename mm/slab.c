@@ -136,7 +136,11 @@
 #define	FORCED_DEBUG	1
 #else
 #define	DEBUG		0
+#ifdef CONFIG_SLAB_STATS
+#define	STATS		1
+#else
 #define	STATS		0
+#endif
 #define	FORCED_DEBUG	0
 #endif
 
@@ -245,6 +249,7 @@ struct array_cache {
 	unsigned int limit;
 	unsigned int batchcount;
 	unsigned int touched;
+	struct array_cache *spare;	/* per-cpu arrays only, see below */
 	spinlock_t lock;
 	void *entry[];	/*
 			 * Must have this definition in here for the proper
@@ -389,6 +394,10 @@ static void kmem_list3_init(struct kmem_list3 *parent)
 #define STATS_INC_ALLOCMISS(x)	atomic_inc(&(x)->allocmiss)
 #define STATS_INC_FREEHIT(x)	atomic_inc(&(x)->freehit)
 #define STATS_INC_FREEMISS(x)	atomic_inc(&(x)->freemiss)
+#define STATS_INC_ALLOCSWAP(x)	atomic_inc(&(x)->allocswap)
+#define STATS_INC_FREESWAP(x)	atomic_inc(&(x)->freeswap)
+#define STATS_ADD_REFILL(x, t)	((x)->refills++, (x)->refill_ns += (t))
+#define STATS_CLOCK()		local_clock()
 #else
 #define	STATS_INC_ACTIVE(x)	do { } while (0)
 #define	STATS_DEC_ACTIVE(x)	do { } while (0)
@@ -405,6 +414,10 @@ static void kmem_list3_init(struct kmem_list3 *parent)
 #define STATS_INC_ALLOCMISS(x)	do { } while (0)
 #define STATS_INC_FREEHIT(x)	do { } while (0)
 #define STATS_INC_FREEMISS(x)	do { } while (0)
+#define STATS_INC_ALLOCSWAP(x)	do { } while (0)
+#define STATS_INC_FREESWAP(x)	do { } while (0)
+#define STATS_ADD_REFILL(x, t)	do { (void)(t); } while (0)
+#define STATS_CLOCK()		0ULL
 #endif
 
 #if DEBUG
@@ -886,11 +899,60 @@ static struct array_cache *alloc_arraycache(int node, int entries,
 		nc->limit = entries;
 		nc->batchcount = batchcount;
 		nc->touched = 0;
+		nc->spare = NULL;
 		spin_lock_init(&nc->lock);
 	}
 	return nc;
 }
 
+/*
+ * Each cpu has a second array_cache hanging off its active one.  When
+ * the active array runs empty on alloc while the spare has objects, or
+ * runs full on free while the spare has room, the two are swapped
+ * instead of going to the l3 lists, so the list_lock is only taken once
+ * both are empty or both are full.  This is the "previous magazine"
+ * of Bonwick's magazine layer; both arrays use the cache's limit and
+ * batchcount tunables.
+ */
+static struct array_cache *alloc_cpu_arraycache(int node, int entries,
+						int batchcount, gfp_t gfp)
+{
+	struct array_cache *nc, *spare;
+
+	nc = alloc_arraycache(node, entries, batchcount, gfp);
+	spare = alloc_arraycache(node, entries, batchcount, gfp);
+	if (!nc || !spare) {
+		kfree(nc);
+		kfree(spare);
+		return NULL;
+	}
+	nc->spare = spare;
+	return nc;
+}
+
+static void free_cpu_arraycache(struct array_cache *nc)
+{
+	if (nc)
+		kfree(nc->spare);
+	kfree(nc);
+}
+
+/*
+ * Swap the active array of this cpu with its spare.  Called with
+ * disabled ints, returns the new active array.
+ */
+static inline struct array_cache *swap_cpu_cache(struct kmem_cache *cachep,
+						 struct array_cache *ac)
+{
+	struct array_cache *spare = ac->spare;
+
+	ac->spare = NULL;
+	spare->spare = ac;
+	spare->touched = 1;
+	cachep->array[smp_processor_id()] = spare;
+	return spare;
+}
+
 /*
  * Transfer objects in one arraycache to another.
  * Locking must be handled by the caller.
@@ -1148,8 +1210,12 @@ static void __cpuinit cpuup_canceled(long cpu)
 
 		/* Free limit for this kmem_list3 */
 		l3->free_limit -= cachep->batchcount;
-		if (nc)
+		if (nc) {
 			free_block(cachep, nc->entry, nc->avail, node);
+			if (nc->spare)
+				free_block(cachep, nc->spare->entry,
+					   nc->spare->avail, node);
+		}
 
 		if (!cpumask_empty(mask)) {
 			spin_unlock_irq(&l3->list_lock);
@@ -1174,7 +1240,7 @@ static void __cpuinit cpuup_canceled(long cpu)
 			free_alien_cache(alien);
 		}
 free_array_cache:
-		kfree(nc);
+		free_cpu_arraycache(nc);
 	}
 	/*
 	 * In the previous loop, all the objects were freed to
@@ -1215,7 +1281,7 @@ static int __cpuinit cpuup_prepare(long cpu)
 		struct array_cache *shared = NULL;
 		struct array_cache **alien = NULL;
 
-		nc = alloc_arraycache(node, cachep->limit,
+		nc = alloc_cpu_arraycache(node, cachep->limit,
 					cachep->batchcount, GFP_KERNEL);
 		if (!nc)
 			goto bad;
@@ -1224,7 +1290,7 @@ static int __cpuinit cpuup_prepare(long cpu)
 				cachep->shared * cachep->batchcount,
 				0xbaadf00d, GFP_KERNEL);
 			if (!shared) {
-				kfree(nc);
+				free_cpu_arraycache(nc);
 				goto bad;
 			}
 		}
@@ -1232,7 +1298,7 @@ static int __cpuinit cpuup_prepare(long cpu)
 			alien = alloc_alien_cache(node, cachep->limit, GFP_KERNEL);
 			if (!alien) {
 				kfree(shared);
-				kfree(nc);
+				free_cpu_arraycache(nc);
 				goto bad;
 			}
 		}
@@ -1994,7 +2060,7 @@ static void __kmem_cache_destroy(struct kmem_cache *cachep)
 	struct kmem_list3 *l3;
 
 	for_each_online_cpu(i)
-	    kfree(cachep->array[i]);
+	    free_cpu_arraycache(cachep->array[i]);
 
 	/* NUMA: free the list3 structures */
 	for_each_online_node(i) {
@@ -2128,6 +2194,7 @@ static int __init_refok setup_cpu_cache(struct kmem_cache *cachep, gfp_t gfp)
 	cpu_cache_get(cachep)->limit = BOOT_CPUCACHE_ENTRIES;
 	cpu_cache_get(cachep)->batchcount = 1;
 	cpu_cache_get(cachep)->touched = 0;
+	cpu_cache_get(cachep)->spare = NULL;
 	cachep->batchcount = 1;
 	cachep->limit = BOOT_CPUCACHE_ENTRIES;
 	return 0;
@@ -2484,6 +2551,10 @@ static void do_drain(void *arg)
 	ac = cpu_cache_get(cachep);
 	spin_lock(&cachep->nodelists[node]->list_lock);
 	free_block(cachep, ac->entry, ac->avail, node);
+	if (ac->spare) {
+		free_block(cachep, ac->spare->entry, ac->spare->avail, node);
+		ac->spare->avail = 0;
+	}
 	spin_unlock(&cachep->nodelists[node]->list_lock);
 	ac->avail = 0;
 }
@@ -3008,6 +3079,7 @@ static void *cache_alloc_refill(struct kmem_cache *cachep, gfp_t flags)
 	struct kmem_list3 *l3;
 	struct array_cache *ac;
 	int node;
+	unsigned long long start;
 
 retry:
 	check_irq_off();
@@ -3025,6 +3097,7 @@ retry:
 	l3 = cachep->nodelists[node];
 
 	BUG_ON(ac->avail > 0 || !l3);
+	start = STATS_CLOCK();
 	spin_lock(&l3->list_lock);
 
 	/* See if we can refill from the shared array */
@@ -3077,6 +3150,7 @@ retry:
 must_grow:
 	l3->free_objects -= ac->avail;
 alloc_done:
+	STATS_ADD_REFILL(cachep, STATS_CLOCK() - start);
 	spin_unlock(&l3->list_lock);
 
 	if (unlikely(!ac->avail)) {
@@ -3183,6 +3257,10 @@ static inline void *____cache_alloc(struct kmem_cache *cachep, gfp_t flags)
 		STATS_INC_ALLOCHIT(cachep);
 		ac->touched = 1;
 		objp = ac->entry[--ac->avail];
+	} else if (ac->spare && ac->spare->avail) {
+		STATS_INC_ALLOCSWAP(cachep);
+		ac = swap_cpu_cache(cachep, ac);
+		objp = ac->entry[--ac->avail];
 	} else {
 		STATS_INC_ALLOCMISS(cachep);
 		objp = cache_alloc_refill(cachep, flags);
@@ -3626,6 +3704,10 @@ static inline void __cache_free(struct kmem_cache *cachep, void *objp)
 		STATS_INC_FREEHIT(cachep);
 		ac->entry[ac->avail++] = objp;
 		return;
+	} else if (ac->spare && ac->spare->avail < ac->spare->limit) {
+		STATS_INC_FREESWAP(cachep);
+		ac = swap_cpu_cache(cachep, ac);
+		ac->entry[ac->avail++] = objp;
 	} else {
 		STATS_INC_FREEMISS(cachep);
 		cache_flusharray(cachep, ac);
@@ -3985,11 +4067,11 @@ static int do_tune_cpucache(struct kmem_cache *cachep, int limit,
 		return -ENOMEM;
 
 	for_each_online_cpu(i) {
-		new->new[i] = alloc_arraycache(cpu_to_mem(i), limit,
+		new->new[i] = alloc_cpu_arraycache(cpu_to_mem(i), limit,
 						batchcount, gfp);
 		if (!new->new[i]) {
 			for (i--; i >= 0; i--)
-				kfree(new->new[i]);
+				free_cpu_arraycache(new->new[i]);
 			kfree(new);
 			return -ENOMEM;
 		}
@@ -4009,8 +4091,11 @@ static int do_tune_cpucache(struct kmem_cache *cachep, int limit,
 			continue;
 		spin_lock_irq(&cachep->nodelists[cpu_to_mem(i)]->list_lock);
 		free_block(cachep, ccold->entry, ccold->avail, cpu_to_mem(i));
+		if (ccold->spare)
+			free_block(cachep, ccold->spare->entry,
+				   ccold->spare->avail, cpu_to_mem(i));
 		spin_unlock_irq(&cachep->nodelists[cpu_to_mem(i)]->list_lock);
-		kfree(ccold);
+		free_cpu_arraycache(ccold);
 	}
 	kfree(new);
 	return alloc_kmemlist(cachep, gfp);
@@ -4135,6 +4220,7 @@ static void cache_reap(struct work_struct *w)
 		reap_alien(searchp, l3);
 
 		drain_array(searchp, l3, cpu_cache_get(searchp), 0, node);
+		drain_array(searchp, l3, cpu_cache_get(searchp)->spare, 0, node);
 
 		/*
 		 * These are racy checks but it does not matter
@@ -4188,6 +4274,8 @@ static void print_slabinfo_header(struct seq_file *m)
 	seq_puts(m, " : globalstat <listallocs> <maxobjs> <grown> <reaped> "
 		 "<error> <maxfreeable> <nodeallocs> <remotefrees> <alienoverflow>");
 	seq_puts(m, " : cpustat <allochit> <allocmiss> <freehit> <freemiss>");
+	seq_puts(m, " : swapstat <allocswap> <freeswap>");
+	seq_puts(m, " : refillstat <refills> <refill_ns>");
 #endif
 	seq_putc(m, '\n');
 }
@@ -4305,6 +4393,15 @@ static int s_show(struct seq_file *m, void *p)
 		seq_printf(m, " : cpustat %6lu %6lu %6lu %6lu",
 			   allochit, allocmiss, freehit, freemiss);
 	}
+	/* spare array and refill stats */
+	{
+		unsigned long allocswap = atomic_read(&cachep->allocswap);
+		unsigned long freeswap = atomic_read(&cachep->freeswap);
+
+		seq_printf(m, " : swapstat %6lu %6lu", allocswap, freeswap);
+		seq_printf(m, " : refillstat %6lu %10llu",
+			   cachep->refills, cachep->refill_ns);
+	}
 #endif
 	seq_putc(m, '\n');
 	return 0;
@@ -292,6 +292,14 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		if (found_page)
 			break;
 
+		/*
+		 * Don't read in a slot nobody refers to: it may be one
+		 * stocked in a per-cpu slot cache, whose SWAP_HAS_CACHE
+		 * would keep swapcache_prepare() failing below.
+		 */
+		if (swap_slot_unused(entry))
+			break;
+
 		/*
 		 * Get a new page to read into from swap.
 		 */
@@ -389,7 +397,7 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
 						gfp_mask, vma, addr);
 		if (!page)
-			break;
+			continue;
 		page_cache_release(page);
 	}
 	lru_add_drain();	/* Push any new pages onto the LRU now */
@@ -436,14 +436,17 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate one slot for swap cache, following the device priorities.
+ * Called with swap_lock held.
+ */
+static swp_entry_t __get_swap_page(void)
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
 
-	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
 	nr_swap_pages--;
@@ -465,19 +468,34 @@ swp_entry_t get_swap_page(void)
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
 		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
+		if (offset)
 			return swp_entry(type, offset);
-		}
 		next = swap_list.next;
 	}
 
 	nr_swap_pages++;
 noswap:
-	spin_unlock(&swap_lock);
 	return (swp_entry_t) {0};
 }
 
+/*
+ * Allocate up to n slots for swap cache under a single swap_lock hold.
+ * Returns the number of slots stored in slots[].
+ */
+static int get_swap_pages(int n, swp_entry_t slots[])
+{
+	int i;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++) {
+		slots[i] = __get_swap_page();
+		if (!slots[i].val)
+			break;
+	}
+	spin_unlock(&swap_lock);
+	return i;
+}
+
 /* The only caller of this function is now susupend routine */
 swp_entry_t get_swap_page_of_type(int type)
 {
@@ -570,28 +588,220 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 		mem_cgroup_uncharge_swap(entry);
 
 	usage = count | has_cache;
-	p->swap_map[offset] = usage;
-
-	/* free if no reference */
-	if (!usage) {
-		struct gendisk *disk = p->bdev->bd_disk;
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		if (swap_list.next >= 0 &&
-		    p->prio > swap_info[swap_list.next]->prio)
-			swap_list.next = p->type;
-		nr_swap_pages++;
-		p->inuse_pages--;
-		if ((p->flags & SWP_BLKDEV) &&
-				disk->fops->swap_slot_free_notify)
-			disk->fops->swap_slot_free_notify(p->bdev, offset);
-	}
+
+	/*
+	 * If no reference is left, keep the slot reserved as SWAP_HAS_CACHE:
+	 * the caller hands it to free_swap_slot() once swap_lock is dropped,
+	 * which releases it to the swap_map in batches.
+	 */
+	p->swap_map[offset] = usage ? usage : SWAP_HAS_CACHE;
 
 	return usage;
 }
 
+/*
+ * Return a reserved slot to the swap_map.  Called with swap_lock held.
+ */
+static void swap_slot_release(struct swap_info_struct *p,
+			      unsigned long offset)
+{
+	struct gendisk *disk = p->bdev->bd_disk;
+
+	VM_BUG_ON(p->swap_map[offset] != SWAP_HAS_CACHE);
+	p->swap_map[offset] = 0;
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	if (swap_list.next >= 0 &&
+	    p->prio > swap_info[swap_list.next]->prio)
+		swap_list.next = p->type;
+	nr_swap_pages++;
+	p->inuse_pages--;
+	if ((p->flags & SWP_BLKDEV) &&
+			disk->fops->swap_slot_free_notify)
+		disk->fops->swap_slot_free_notify(p->bdev, offset);
+}
+
+static void swap_slots_release(swp_entry_t *entries, int n)
+{
+	int i;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++)
+		swap_slot_release(swap_info[swp_type(entries[i])],
+				  swp_offset(entries[i]));
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * Per-cpu swap slot caches.
+ *
+ * Swapping out a page needs a free slot, and scan_swap_map() has to be
+ * called under swap_lock for each one.  Instead, each cpu keeps a small
+ * stock of slots allocated SWAP_SLOTS_CACHE_SIZE at a time, and hands
+ * them out under its own mutex (the refill may sleep in scan_swap_map).
+ * Likewise, slots whose last reference is dropped are collected on the
+ * freeing cpu and given back to the swap_map in one swap_lock pass.
+ *
+ * Slots held in either cache stay marked SWAP_HAS_CACHE in the swap_map,
+ * without a page in swapper_space, so swapoff must drain the caches
+ * before try_to_unuse() and keep them disabled until it is done.
+ */
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, cur, nr */
+	int		cur;
+	int		nr;
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	int		n_ret;
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+
+/* Disable count, caches are only used while it is zero: see swap_slots_init */
+static int swap_slots_cache_disabled = 1;
+
+static void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	spin_lock(&cache->free_lock);
+	if (unlikely(swap_slots_cache_disabled)) {
+		spin_unlock(&cache->free_lock);
+		swap_slots_release(&entry, 1);
+		return;
+	}
+	if (cache->n_ret == SWAP_SLOTS_CACHE_SIZE) {
+		swap_slots_release(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	cache->slots_ret[cache->n_ret++] = entry;
+	spin_unlock(&cache->free_lock);
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	/*
+	 * Don't let each cpu stock a batch of the last few free slots,
+	 * when other cpus may be left with none.
+	 */
+	if (nr_swap_pages < num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2)
+		goto direct;
+
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	mutex_lock(&cache->alloc_lock);
+	if (unlikely(swap_slots_cache_disabled)) {
+		mutex_unlock(&cache->alloc_lock);
+		goto direct;
+	}
+	if (cache->cur == cache->nr) {
+		cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+		cache->cur = 0;
+	}
+	entry.val = 0;
+	if (cache->cur < cache->nr)
+		entry = cache->slots[cache->cur++];
+	mutex_unlock(&cache->alloc_lock);
+	return entry;
+
+direct:
+	if (!get_swap_pages(1, &entry))
+		entry.val = 0;
+	return entry;
+}
+
+/*
+ * Give the slots stocked by one cpu back to the swap_map.
+ */
+static void drain_swap_slots_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	mutex_lock(&cache->alloc_lock);
+	while (cache->cur < cache->nr)
+		swapcache_free(cache->slots[cache->cur++], NULL);
+	cache->cur = cache->nr = 0;
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	swap_slots_release(cache->slots_ret, cache->n_ret);
+	cache->n_ret = 0;
+	spin_unlock(&cache->free_lock);
+}
+
+/*
+ * Drain all per-cpu slot caches and keep them out of use until the
+ * matching enable_swap_slots_cache().
+ */
+static void disable_swap_slots_cache(void)
+{
+	unsigned int cpu;
+
+	mutex_lock(&swap_slots_cache_mutex);
+	if (!swap_slots_cache_disabled++) {
+		for_each_possible_cpu(cpu)
+			drain_swap_slots_cpu(cpu);
+	}
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void enable_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slots_cache_disabled--;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+/*
+ * Is nobody referencing this slot, so that reading it in would be
+ * pointless?  A slot stocked in a per-cpu cache has SWAP_HAS_CACHE set
+ * but no page, and would otherwise make read_swap_cache_async() spin.
+ * While swapoff has the caches disabled, answer no: try_to_unuse()
+ * must be allowed to wait out a racing add_to_swap().
+ */
+int swap_slot_unused(swp_entry_t entry)
+{
+	struct swap_info_struct *si = swap_info[swp_type(entry)];
+	unsigned long offset = swp_offset(entry);
+
+	if (swap_slots_cache_disabled || offset >= si->max)
+		return 0;
+	return !swap_count(si->swap_map[offset]);
+}
+
+static int __cpuinit swap_slots_cpu_notify(struct notifier_block *self,
+					   unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_swap_slots_cpu((unsigned long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_notify, 0);
+	enable_swap_slots_cache();
+	return 0;
+}
+__initcall(swap_slots_init);
+
 /*
  * Caller has made sure that the swapdevice corresponding to entry
  * is still around or has not been recycled.
@@ -599,11 +809,14 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	unsigned char usage;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, 1);
+		usage = swap_entry_free(p, entry, 1);
 		spin_unlock(&swap_lock);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 }
 
@@ -621,6 +834,8 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
 		spin_unlock(&swap_lock);
+		if (!count)
+			free_swap_slot(entry);
 	}
 }
 
@@ -714,13 +929,15 @@ int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	struct page *page = NULL;
+	unsigned char usage;
 
 	if (non_swap_entry(entry))
 		return 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, 1) == SWAP_HAS_CACHE) {
+		usage = swap_entry_free(p, entry, 1);
+		if (usage == SWAP_HAS_CACHE) {
 			page = find_get_page(&swapper_space, entry.val);
 			if (page && !trylock_page(page)) {
 				page_cache_release(page);
@@ -728,6 +945,8 @@ int free_swap_and_cache(swp_entry_t entry)
 			}
 		}
 		spin_unlock(&swap_lock);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 	if (page) {
 		/*
@@ -1609,9 +1828,11 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	disable_swap_slots_cache();
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
+	enable_swap_slots_cache();
 
 	if (err) {
 		/* re-insert swap space back into swap_list */
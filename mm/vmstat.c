@@ -832,6 +832,11 @@ static const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"workingset_refault",
+	"workingset_activate",
+	"readahead_hit",
+	"readahead_miss",
+	"readahead_wasted",
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
@@ -892,6 +897,7 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 		   "\n  pagesets");
 	for_each_online_cpu(i) {
 		struct per_cpu_pageset *pageset;
+		int j;
 
 		pageset = per_cpu_ptr(zone->pageset, i);
 		seq_printf(m,
@@ -903,6 +909,15 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
 			   pageset->pcp.batch);
+		for (j = 0; j < PCP_MAX_ORDER; j++)
+			seq_printf(m,
+				   "\n      order %i count: %i"
+				   "\n              high:  %i"
+				   "\n              batch: %i",
+				   j + 1,
+				   pageset->pcp_order[j].count,
+				   pageset->pcp_order[j].high,
+				   pageset->pcp_order[j].batch);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
@@ -0,0 +1,167 @@
+/*
+ * linux/mm/workingset.c
+ *
+ * Refault detection for the file page cache.
+ *
+ * The inactive file list is sized by inactive_file_is_low() alone, so a
+ * page that is used regularly, but less often than the inactive list
+ * cycles, gets evicted again and again while a stream of use-once pages
+ * keeps flowing through the list.  To catch this, remember recently
+ * evicted pages, and when one of them is faulted back in, look at how
+ * far the inactive list has moved since its eviction.
+ *
+ * Every eviction and every activation of a file page advances a global
+ * clock.  When a page is reclaimed, a cookie for its (mapping, index)
+ * is stored along with the clock.  When a page is added to the page
+ * cache again and its cookie is found, the difference between the clock
+ * now and at eviction is the refault distance: the minimum number of
+ * extra inactive slots the page would have needed to still be resident.
+ * If that distance is no bigger than the active file list, the page is
+ * part of the working set and competes better on the active list, so it
+ * is activated straight away.
+ *
+ * The cookies live in a hash table of small buckets with FIFO
+ * replacement, rather than in the page cache radix tree, so that page
+ * cache lookups and truncation don't have to know about them.  A stale
+ * or colliding cookie can only cause one early activation.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/bootmem.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/vmstat.h>
+#include <linux/init.h>
+
+#define WORKINGSET_BUCKET_SLOTS	7
+
+/* One cacheline per bucket on 32-bit */
+struct workingset_bucket {
+	spinlock_t lock;
+	u32 hand;
+	u32 cookie[WORKINGSET_BUCKET_SLOTS];
+	u32 evicted[WORKINGSET_BUCKET_SLOTS];
+};
+
+static struct workingset_bucket *workingset_hash __read_mostly;
+static unsigned int workingset_hash_mask __read_mostly;
+static unsigned int workingset_hash_shift __read_mostly;
+
+/* File evictions and activations seen so far */
+static atomic_t workingset_clock = ATOMIC_INIT(0);
+
+static u32 workingset_key(struct address_space *mapping, pgoff_t index)
+{
+	return jhash_2words(hash_ptr(mapping, 32), (u32)index, 0);
+}
+
+static struct workingset_bucket *workingset_bucket(u32 key)
+{
+	return &workingset_hash[key & workingset_hash_mask];
+}
+
+/* Empty slots hold 0, so a cookie never is */
+static u32 workingset_cookie(u32 key)
+{
+	return (key >> workingset_hash_shift) | 1;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page cache page
+ * @mapping: address space the page was mapped to
+ * @page: the page being evicted
+ *
+ * Called from reclaim, with the mapping's tree_lock held.
+ */
+void workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	u32 key = workingset_key(mapping, page->index);
+	struct workingset_bucket *b;
+	unsigned long flags;
+
+	if (!workingset_hash)
+		return;
+
+	b = workingset_bucket(key);
+	spin_lock_irqsave(&b->lock, flags);
+	b->cookie[b->hand] = workingset_cookie(key);
+	b->evicted[b->hand] = atomic_inc_return(&workingset_clock);
+	if (++b->hand == WORKINGSET_BUCKET_SLOTS)
+		b->hand = 0;
+	spin_unlock_irqrestore(&b->lock, flags);
+}
+
+/**
+ * workingset_refault - check whether a page cache page is refaulting
+ * @mapping: address space the page is being added to
+ * @index: offset of the page in @mapping
+ *
+ * Returns true if the page was evicted recently enough that it should
+ * be activated straight away.
+ */
+bool workingset_refault(struct address_space *mapping, pgoff_t index)
+{
+	u32 key = workingset_key(mapping, index);
+	u32 cookie = workingset_cookie(key);
+	struct workingset_bucket *b;
+	unsigned long flags;
+	u32 distance;
+	int i;
+
+	if (!workingset_hash)
+		return false;
+
+	b = workingset_bucket(key);
+	spin_lock_irqsave(&b->lock, flags);
+	for (i = 0; i < WORKINGSET_BUCKET_SLOTS; i++)
+		if (b->cookie[i] == cookie)
+			break;
+	if (i == WORKINGSET_BUCKET_SLOTS) {
+		spin_unlock_irqrestore(&b->lock, flags);
+		return false;
+	}
+	b->cookie[i] = 0;
+	distance = (u32)atomic_read(&workingset_clock) - b->evicted[i];
+	spin_unlock_irqrestore(&b->lock, flags);
+
+	count_vm_event(WORKINGSET_REFAULT);
+	if (distance > global_page_state(NR_ACTIVE_FILE))
+		return false;
+	count_vm_event(WORKINGSET_ACTIVATE);
+	return true;
+}
+
+/**
+ * workingset_activation - note a page cache page being activated
+ * @page: the page
+ *
+ * Activations age the inactive list just as evictions do.
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_inc(&workingset_clock);
+}
+
+static int __init workingset_init(void)
+{
+	struct workingset_bucket *hash;
+	unsigned int i;
+
+	/* One bucket for every 16 pages of memory */
+	hash = alloc_large_system_hash("Workingset",
+				       sizeof(struct workingset_bucket),
+				       0, PAGE_SHIFT + 4, 0,
+				       &workingset_hash_shift,
+				       &workingset_hash_mask, 0);
+	for (i = 0; i <= workingset_hash_mask; i++) {
+		spin_lock_init(&hash[i].lock);
+		hash[i].hand = 0;
+		memset(hash[i].cookie, 0, sizeof(hash[i].cookie));
+	}
+	smp_wmb();
+	workingset_hash = hash;
+	return 0;
+}
+module_init(workingset_init);
@@ -540,6 +540,21 @@ int security_inode_permission(struct inode *inode, int mask)
 }
 EXPORT_SYMBOL(security_inode_permission);
 
+/*
+ * Like security_inode_permission(inode, MAY_EXEC), but for the RCU path
+ * walk, which holds no reference on @inode and must not sleep.  Only the
+ * default capability hooks are known to cope with that; with any other
+ * module loaded -ECHILD tells the caller to retry with a reference held.
+ */
+int security_inode_exec_permission_rcu(struct inode *inode)
+{
+	if (unlikely(IS_PRIVATE(inode)))
+		return 0;
+	if (security_ops != &default_security_ops)
+		return -ECHILD;
+	return security_ops->inode_permission(inode, MAY_EXEC);
+}
+
 int security_inode_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	if (unlikely(IS_PRIVATE(dentry->d_inode)))